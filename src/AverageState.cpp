@@ -0,0 +1,298 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AverageState.h"
+#include "Serializer.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+
+namespace PstpFinder
+{
+  static constexpr std::uint32_t sidecarMagic = 0x50535041; // "PSPA"
+  static constexpr std::uint32_t sidecarVersion = 1;
+
+  AverageState::AverageState(unsigned int nAtoms) :
+      count(0), lastFrame(0), center { 0, 0, 0 }, meanX(nAtoms, 0),
+      meanY(nAtoms, 0), meanZ(nAtoms, 0), m2(nAtoms, 0)
+  {
+  }
+
+  unsigned int
+  AverageState::getAtoms() const
+  {
+    return meanX.size();
+  }
+
+  void
+  AverageState::add(const double* x, const double* y, const double* z,
+                    const double* frameCenter, unsigned int frame)
+  {
+    if(count == 0 or frame >= lastFrame)
+    {
+      std::copy(frameCenter, frameCenter + 3, center);
+      lastFrame = frame;
+    }
+
+    count++;
+    const unsigned int nAtoms = meanX.size();
+    const double invCount = 1.0 / count;
+    double* const mx = meanX.data();
+    double* const my = meanY.data();
+    double* const mz = meanZ.data();
+    double* const s2 = m2.data();
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      const double dx = x[i] - mx[i];
+      const double dy = y[i] - my[i];
+      const double dz = z[i] - mz[i];
+      mx[i] += dx * invCount;
+      my[i] += dy * invCount;
+      mz[i] += dz * invCount;
+      s2[i] += dx * (x[i] - mx[i]) + dy * (y[i] - my[i])
+               + dz * (z[i] - mz[i]);
+    }
+  }
+
+  void
+  AverageState::merge(const AverageState& other)
+  {
+    if(other.count == 0)
+      return;
+
+    if(count == 0 or other.lastFrame >= lastFrame)
+    {
+      std::copy(other.center, other.center + 3, center);
+      lastFrame = other.lastFrame;
+    }
+
+    const unsigned int nAtoms = meanX.size();
+    const double total = static_cast<double>(count) + other.count;
+    const double weight = other.count / total;
+    const double cross = static_cast<double>(count) * other.count / total;
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      const double dx = other.meanX[i] - meanX[i];
+      const double dy = other.meanY[i] - meanY[i];
+      const double dz = other.meanZ[i] - meanZ[i];
+      meanX[i] += dx * weight;
+      meanY[i] += dy * weight;
+      meanZ[i] += dz * weight;
+      m2[i] += other.m2[i] + (dx * dx + dy * dy + dz * dz) * cross;
+    }
+
+    count += other.count;
+  }
+
+  AverageCheckpoint::AverageCheckpoint() :
+      sasFrames(0)
+  {
+  }
+
+  AverageCheckpoint::AverageCheckpoint(unsigned int sasFrames,
+                                       const AverageState& state) :
+      sasFrames(sasFrames), state(state)
+  {
+  }
+
+  unsigned int
+  AverageCheckpoint::getSasFrames() const
+  {
+    return sasFrames;
+  }
+
+  const AverageState&
+  AverageCheckpoint::getState() const
+  {
+    return state;
+  }
+
+  bool
+  AverageCheckpoint::save(const std::string& sessionFileName,
+                          std::uint64_t sasOffset) const
+  {
+    // Written aside and renamed, a reader never sees a partial checkpoint
+    const std::string fileName = getSidecarFileName(sessionFileName);
+    const std::string temporary = fileName + ".tmp";
+    {
+      std::ofstream stream(temporary, std::ios_base::out
+                                      | std::ios_base::binary
+                                      | std::ios_base::trunc);
+      if(not stream)
+        return false;
+
+      Serializer<std::ofstream> serializer(stream);
+      serializer << sidecarMagic << sidecarVersion << sasOffset
+                 << static_cast<std::uint32_t>(state.getAtoms())
+                 << static_cast<std::uint32_t>(sasFrames)
+                 << static_cast<std::uint32_t>(state.count)
+                 << static_cast<std::uint32_t>(state.lastFrame)
+                 << state.center[0] << state.center[1] << state.center[2]
+                 << state.meanX << state.meanY << state.meanZ << state.m2;
+      if(not stream.flush())
+      {
+        stream.close();
+        std::remove(temporary.c_str());
+        return false;
+      }
+    }
+
+    if(std::rename(temporary.c_str(), fileName.c_str()) != 0)
+    {
+      std::remove(temporary.c_str());
+      return false;
+    }
+
+    return true;
+  }
+
+  bool
+  AverageCheckpoint::load(const std::string& sessionFileName,
+                          std::uint64_t sasOffset, unsigned int nAtoms)
+  {
+    std::ifstream stream(getSidecarFileName(sessionFileName),
+                         std::ios_base::in | std::ios_base::binary);
+    if(not stream)
+      return false;
+
+    Serializer<std::ifstream> serializer(stream);
+    std::uint32_t magic, version, atoms, frames, count, lastFrame;
+    std::uint64_t storedOffset;
+    serializer >> magic >> version >> storedOffset >> atoms;
+    if(not stream or magic != sidecarMagic or version != sidecarVersion
+       or storedOffset != sasOffset or atoms != nAtoms)
+      return false;
+
+    AverageState stored;
+    serializer >> frames >> count >> lastFrame >> stored.center[0]
+               >> stored.center[1] >> stored.center[2] >> stored.meanX
+               >> stored.meanY >> stored.meanZ >> stored.m2;
+    if(not stream or stored.meanX.size() != nAtoms
+       or stored.meanY.size() != nAtoms or stored.meanZ.size() != nAtoms
+       or stored.m2.size() != nAtoms)
+      return false;
+
+    stored.count = count;
+    stored.lastFrame = lastFrame;
+    sasFrames = frames;
+    state = std::move(stored);
+    return true;
+  }
+
+  void
+  AverageCheckpoint::remove(const std::string& sessionFileName)
+  {
+    std::remove(getSidecarFileName(sessionFileName).c_str());
+  }
+
+  std::string
+  AverageCheckpoint::getSidecarFileName(const std::string& sessionFileName)
+  {
+    return sessionFileName + ".pstpavg";
+  }
+
+  AverageSnapshots::AverageSnapshots(
+      unsigned int contributors, unsigned int firstSasFrame,
+      unsigned int sasStride, unsigned int interval,
+      const std::function<void(AverageCheckpoint&&)>& done) :
+      sasStride(sasStride), interval(interval), done(done),
+      reached(contributors, firstSasFrame / interval),
+      finished(contributors, false), finalStates(contributors)
+  {
+  }
+
+  void
+  AverageSnapshots::reach(unsigned int contributor,
+                          unsigned int trajectoryFrame,
+                          const AverageState& state)
+  {
+    /*
+     * Checkpoints up to this frame are not reached yet by the contributor,
+     * so its state holds exactly its frames before them.
+     */
+    const unsigned int last = trajectoryFrame / sasStride / interval;
+    if(last <= reached[contributor])
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for(unsigned int checkpoint = reached[contributor] + 1;
+        checkpoint <= last; checkpoint++)
+      report(contributor, checkpoint, state);
+    reached[contributor] = last;
+  }
+
+  void
+  AverageSnapshots::finish(unsigned int contributor,
+                           const AverageState& state)
+  {
+    // Its frames are all before the checkpoints it did not reach
+    std::lock_guard<std::mutex> lock(mutex);
+    finished[contributor] = true;
+    finalStates[contributor] = state;
+    while(not snapshots.empty())
+    {
+      auto next = snapshots.upper_bound(reached[contributor]);
+      if(next == std::end(snapshots))
+        break;
+      reached[contributor] = next->first;
+      report(contributor, next->first, state);
+    }
+  }
+
+  AverageSnapshots::Snapshot&
+  AverageSnapshots::getSnapshot(unsigned int checkpoint)
+  {
+    auto found = snapshots.find(checkpoint);
+    if(found != std::end(snapshots))
+      return found->second;
+
+    Snapshot& snapshot = snapshots[checkpoint];
+    snapshot.states.resize(reached.size());
+    snapshot.reports = 0;
+    for(unsigned int i = 0; i < reached.size(); i++)
+      if(finished[i])
+      {
+        snapshot.states[i] = finalStates[i];
+        snapshot.reports++;
+      }
+    return snapshot;
+  }
+
+  void
+  AverageSnapshots::report(unsigned int contributor, unsigned int checkpoint,
+                           const AverageState& state)
+  {
+    Snapshot& snapshot = getSnapshot(checkpoint);
+    snapshot.states[contributor] = state;
+    if(++snapshot.reports < reached.size())
+      return;
+
+    // Merged in the same order every time, whoever got there last
+    AverageState merged(std::move(snapshot.states[0]));
+    for(unsigned int i = 1; i < snapshot.states.size(); i++)
+      merged.merge(snapshot.states[i]);
+    snapshots.erase(checkpoint);
+
+    // Frames lost on abort would make it wrong
+    const unsigned int sasFrames = checkpoint * interval;
+    if(merged.count == sasFrames * sasStride)
+      done(AverageCheckpoint(sasFrames, merged));
+  }
+}
@@ -0,0 +1,127 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AVERAGESTATE_H
+#define _AVERAGESTATE_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Welford mean and squared deviations of the atoms of a group
+   */
+  struct AverageState
+  {
+    unsigned int count;
+    // Position of the last frame in the trajectory, and its center
+    unsigned int lastFrame;
+    double center[3];
+    std::vector<double> meanX, meanY, meanZ;
+    // Sum of the squared deviations of the three coordinates
+    std::vector<double> m2;
+
+    AverageState(unsigned int nAtoms = 0);
+    unsigned int getAtoms() const;
+    void add(const double* x, const double* y, const double* z,
+             const double* frameCenter, unsigned int frame);
+    void merge(const AverageState& other);
+  };
+
+  /**
+   * @brief Average of the first sasFrames SAS frames, in session + ".pstpavg"
+   */
+  class AverageCheckpoint
+  {
+    public:
+      AverageCheckpoint();
+      AverageCheckpoint(unsigned int sasFrames, const AverageState& state);
+
+      unsigned int getSasFrames() const;
+      const AverageState& getState() const;
+
+      bool save(const std::string& sessionFileName,
+                std::uint64_t sasOffset) const;
+
+      /**
+       * @return false if there is none, or it is of another session
+       */
+      bool load(const std::string& sessionFileName, std::uint64_t sasOffset,
+                unsigned int nAtoms);
+
+      static void remove(const std::string& sessionFileName);
+      static std::string getSidecarFileName(
+          const std::string& sessionFileName);
+
+    private:
+      unsigned int sasFrames;
+      AverageState state;
+  };
+
+  /**
+   * @brief Checkpoints, every interval SAS frames, of a shared average
+   *
+   * Contributors reach() each of their frames, in order, before adding it.
+   */
+  class AverageSnapshots
+  {
+    public:
+      AverageSnapshots(
+          unsigned int contributors, unsigned int firstSasFrame,
+          unsigned int sasStride, unsigned int interval,
+          const std::function<void(AverageCheckpoint&&)>& done);
+
+      void reach(unsigned int contributor, unsigned int trajectoryFrame,
+                 const AverageState& state);
+      // The contributor has no more frames to average
+      void finish(unsigned int contributor, const AverageState& state);
+
+    private:
+      struct Snapshot
+      {
+        std::vector<AverageState> states;
+        unsigned int reports;
+      };
+
+      const unsigned int sasStride;
+      const unsigned int interval;
+      const std::function<void(AverageCheckpoint&&)> done;
+      // Last checkpoint reported by each contributor, written by its owner
+      std::vector<unsigned int> reached;
+      std::vector<bool> finished;
+      std::vector<AverageState> finalStates;
+      std::map<unsigned int, Snapshot> snapshots;
+      std::mutex mutex;
+
+      Snapshot& getSnapshot(unsigned int checkpoint);
+      void report(unsigned int contributor, unsigned int checkpoint,
+                  const AverageState& state);
+  };
+}
+
+#endif /* _AVERAGESTATE_H */
@@ -0,0 +1,232 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AverageState.h"
+#include "UnitTest.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+
+using namespace PstpFinder;
+using UnitTest::check;
+
+static const unsigned int nAtoms = 5;
+static const unsigned int sasStride = 2;
+static const unsigned int interval = 4;
+static const unsigned int nWorkers = 2;
+static const std::uint64_t sasOffset = 64;
+
+static void
+addFrame(AverageState& state, unsigned int frame)
+{
+  double x[nAtoms], y[nAtoms], z[nAtoms];
+  const double center[3] = { 0, 0, 0 };
+  for(unsigned int i = 0; i < nAtoms; i++)
+  {
+    x[i] = i + std::sin(frame * 0.7 + i);
+    y[i] = 2 * i + std::cos(frame * 1.3 - i);
+    z[i] = std::sin(frame * 0.1) * i;
+  }
+  state.add(x, y, z, center, frame);
+}
+
+static bool
+sameState(const AverageState& a, const AverageState& b)
+{
+  if(a.count != b.count or a.getAtoms() != b.getAtoms())
+    return false;
+
+  for(unsigned int i = 0; i < a.getAtoms(); i++)
+    if(std::fabs(a.meanX[i] - b.meanX[i]) > 1e-9
+       or std::fabs(a.meanY[i] - b.meanY[i]) > 1e-9
+       or std::fabs(a.meanZ[i] - b.meanZ[i]) > 1e-9
+       or std::fabs(a.m2[i] - b.m2[i]) > 1e-9)
+      return false;
+  return true;
+}
+
+/*
+ * Same as the SAS pipeline: the reader averages the frames between SAS
+ * frames, workers take turns on the SAS frames. The reader goes first, so
+ * checkpoints wait for the workers. Decoded frames are recorded.
+ */
+static AverageState
+average(AverageState reader, unsigned int firstSasFrame,
+        unsigned int lastSasFrame, AverageSnapshots& snapshots,
+        std::vector<unsigned int>& decoded, unsigned int lostFrame = -1)
+{
+  for(unsigned int sasFrame = firstSasFrame; sasFrame < lastSasFrame;
+      sasFrame++)
+  {
+    const unsigned int trajectoryFrame = sasFrame * sasStride;
+    snapshots.reach(0, trajectoryFrame, reader);
+    decoded.push_back(trajectoryFrame);
+    for(unsigned int frame = trajectoryFrame + 1;
+        frame < trajectoryFrame + sasStride; frame++)
+    {
+      decoded.push_back(frame);
+      addFrame(reader, frame);
+    }
+  }
+
+  std::vector<AverageState> workers(nWorkers, AverageState(nAtoms));
+  for(unsigned int sasFrame = firstSasFrame; sasFrame < lastSasFrame;
+      sasFrame++)
+  {
+    const unsigned int trajectoryFrame = sasFrame * sasStride;
+    if(trajectoryFrame == lostFrame)
+      continue;
+
+    AverageState& worker = workers[sasFrame % nWorkers];
+    snapshots.reach(1 + sasFrame % nWorkers, trajectoryFrame, worker);
+    addFrame(worker, trajectoryFrame);
+  }
+
+  snapshots.finish(0, reader);
+  for(unsigned int i = 0; i < nWorkers; i++)
+    snapshots.finish(i + 1, workers[i]);
+
+  for(const AverageState& worker : workers)
+    reader.merge(worker);
+  return reader;
+}
+
+/*
+ * An analysis stops at SAS frame 14, after the checkpoint at 12 is saved.
+ * The resumed one must not decode the frames before it, and must end with
+ * the same average as an analysis that never stopped.
+ */
+static void
+testResume(const std::string& sessionFileName)
+{
+  const unsigned int nSasFrames = 20;
+  std::vector<unsigned int> decoded;
+  std::vector<AverageCheckpoint> checkpoints;
+  auto done = [&](AverageCheckpoint&& checkpoint)
+  {
+    checkpoints.push_back(std::move(checkpoint));
+  };
+
+  AverageSnapshots full(1 + nWorkers, 0, sasStride, interval, done);
+  const AverageState expected = average(AverageState(nAtoms), 0, nSasFrames,
+                                        full, decoded);
+  check(expected.count == nSasFrames * sasStride,
+        "resume: frames lost by the full average");
+
+  checkpoints.clear();
+  AverageSnapshots stopped(1 + nWorkers, 0, sasStride, interval, done);
+  average(AverageState(nAtoms), 0, 14, stopped, decoded);
+  check(checkpoints.size() == 3 and checkpoints[0].getSasFrames() == 4
+        and checkpoints[1].getSasFrames() == 8
+        and checkpoints[2].getSasFrames() == 12,
+        "resume: wrong checkpoints");
+  check(not checkpoints.empty()
+        and checkpoints.back().save(sessionFileName, sasOffset),
+        "resume: save failed");
+
+  AverageCheckpoint checkpoint;
+  check(checkpoint.load(sessionFileName, sasOffset, nAtoms),
+        "resume: load failed");
+  const unsigned int first = checkpoint.getSasFrames();
+  check(first == 12 and checkpoint.getState().count == first * sasStride,
+        "resume: wrong checkpoint loaded");
+
+  decoded.clear();
+  checkpoints.clear();
+  AverageSnapshots resumed(1 + nWorkers, first, sasStride, interval, done);
+  const AverageState result = average(checkpoint.getState(), first,
+                                      nSasFrames, resumed, decoded);
+  bool skipped = not decoded.empty();
+  for(unsigned int frame : decoded)
+    skipped = skipped and frame >= first * sasStride;
+  check(skipped, "resume: frames before the checkpoint decoded");
+  check(sameState(result, expected),
+        "resume: average differs from the one without stopping");
+  check(checkpoints.size() == 1 and checkpoints[0].getSasFrames() == 16,
+        "resume: wrong checkpoints after resuming");
+}
+
+static void
+testLostFrame()
+{
+  // A frame dropped on abort must not end in a checkpoint
+  std::vector<unsigned int> decoded;
+  std::vector<AverageCheckpoint> checkpoints;
+  AverageSnapshots snapshots(1 + nWorkers, 0, sasStride, interval,
+                             [&](AverageCheckpoint&& checkpoint)
+                             {
+                               checkpoints.push_back(std::move(checkpoint));
+                             });
+  average(AverageState(nAtoms), 0, 14, snapshots, decoded, 10 * sasStride);
+  check(checkpoints.size() == 2 and checkpoints[1].getSasFrames() == 8,
+        "lost frame: checkpoint with a missing frame");
+}
+
+static void
+testLoad(const std::string& sessionFileName)
+{
+  AverageState state(nAtoms);
+  for(unsigned int frame = 0; frame < 8; frame++)
+    addFrame(state, frame);
+  check(AverageCheckpoint(4, state).save(sessionFileName, sasOffset),
+        "load: save failed");
+
+  AverageCheckpoint checkpoint;
+  check(not checkpoint.load(sessionFileName, sasOffset + 1, nAtoms),
+        "load: checkpoint of another session loaded");
+  check(not checkpoint.load(sessionFileName, sasOffset, nAtoms + 1),
+        "load: checkpoint of another group loaded");
+  check(checkpoint.load(sessionFileName, sasOffset, nAtoms)
+        and sameState(checkpoint.getState(), state),
+        "load: state changed");
+
+  const std::string fileName =
+      AverageCheckpoint::getSidecarFileName(sessionFileName);
+  std::string content;
+  {
+    std::ifstream stream(fileName.c_str(), std::ios::binary);
+    content.assign(std::istreambuf_iterator<char>(stream),
+                   std::istreambuf_iterator<char>());
+  }
+  std::ofstream(fileName.c_str(), std::ios::binary | std::ios::trunc)
+      << content.substr(0, content.size() - 8);
+  check(not checkpoint.load(sessionFileName, sasOffset, nAtoms),
+        "load: truncated checkpoint loaded");
+
+  AverageCheckpoint::remove(sessionFileName);
+  check(not checkpoint.load(sessionFileName, sasOffset, nAtoms),
+        "load: removed checkpoint loaded");
+}
+
+int
+main()
+{
+  const std::string sessionFileName("AverageStateTest.pstp");
+  testResume(sessionFileName);
+  testLostFrame();
+  testLoad(sessionFileName);
+
+  AverageCheckpoint::remove(sessionFileName);
+
+  return UnitTest::result();
+}
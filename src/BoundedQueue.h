@@ -0,0 +1,140 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BOUNDEDQUEUE_H
+#define _BOUNDEDQUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace PstpFinder
+{
+  /**
+   * @brief A blocking FIFO queue with a maximum number of elements
+   *
+   * push() waits while the queue is full, pop() waits while it is empty.
+   * Once close() is called every waiting thread is woken up: push() starts
+   * failing and pop() drains the remaining elements before failing too.
+   *
+   * Elements live in a ring allocated once, so moving them through the
+   * queue never allocates.
+   */
+  template<typename T>
+  class BoundedQueue
+  {
+    public:
+      BoundedQueue(std::size_t capacity);
+      BoundedQueue(const BoundedQueue&) = delete;
+      BoundedQueue& operator =(const BoundedQueue&) = delete;
+
+      bool push(T&& value);
+      bool pop(T& value);
+
+      /**
+       * @brief Like pop(), but fails instead of waiting on an empty queue
+       */
+      bool tryPop(T& value);
+      void close();
+      bool isClosed() const;
+
+    private:
+      std::vector<T> elements;
+      std::size_t head;
+      std::size_t count;
+      bool closed;
+      mutable std::mutex queueMutex;
+      std::condition_variable notFull, notEmpty;
+  };
+
+  template<typename T>
+  BoundedQueue<T>::BoundedQueue(std::size_t capacity) :
+      elements(capacity > 0 ? capacity : 1), head(0), count(0), closed(false)
+  {
+  }
+
+  template<typename T>
+  bool
+  BoundedQueue<T>::push(T&& value)
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while(count >= elements.size() and not closed)
+      notFull.wait(lock);
+
+    if(closed)
+      return false;
+
+    elements[(head + count++) % elements.size()] = std::move(value);
+    notEmpty.notify_one();
+    return true;
+  }
+
+  template<typename T>
+  bool
+  BoundedQueue<T>::pop(T& value)
+  {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while(count == 0 and not closed)
+      notEmpty.wait(lock);
+
+    if(count == 0)
+      return false;
+
+    value = std::move(elements[head]);
+    head = (head + 1) % elements.size();
+    count--;
+    notFull.notify_one();
+    return true;
+  }
+
+  template<typename T>
+  bool
+  BoundedQueue<T>::tryPop(T& value)
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if(count == 0)
+      return false;
+
+    value = std::move(elements[head]);
+    head = (head + 1) % elements.size();
+    count--;
+    notFull.notify_one();
+    return true;
+  }
+
+  template<typename T>
+  void
+  BoundedQueue<T>::close()
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+
+  template<typename T>
+  bool
+  BoundedQueue<T>::isClosed() const
+  {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return closed;
+  }
+}
+
+#endif /* _BOUNDEDQUEUE_H */
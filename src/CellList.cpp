@@ -0,0 +1,180 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CellList.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace PstpFinder
+{
+  CellList::CellList()
+  {
+    nCells.fill(1);
+    periodic.fill(false);
+    for(int d = 0; d < DIM; d++)
+      for(int n = 0; n < DIM; n++)
+        cellBox[d][n] = 0;
+  }
+
+  static inline real
+  norm(real x, real y, real z)
+  {
+    return std::sqrt(x * x + y * y + z * z);
+  }
+
+  void
+  CellList::build(const real* x, const real* y, const real* z,
+                  unsigned int nAtoms, real cutoff, int ePBC,
+                  const matrix box)
+  {
+    const bool usePBC = box != nullptr and ePBC != epbcNONE;
+    periodic[XX] = usePBC;
+    periodic[YY] = usePBC;
+    periodic[ZZ] = usePBC and ePBC != epbcXY;
+
+    /*
+     * Box vectors used for the fractional coordinates. A non periodic Z uses
+     * a unit vector, so that the heights of X and Y are still right.
+     */
+    for(int d = 0; d < DIM; d++)
+      for(int n = 0; n < DIM; n++)
+        cellBox[d][n] = usePBC ? box[d][n] : (d == n ? 1 : 0);
+    if(not periodic[ZZ])
+    {
+      cellBox[ZZ][XX] = 0;
+      cellBox[ZZ][YY] = 0;
+      cellBox[ZZ][ZZ] = 1;
+    }
+
+    rvec lower = { 0, 0, 0 };
+    rvec extent = { 1, 1, 1 };
+    for(int d = 0; d < DIM; d++)
+    {
+      if(periodic[d] or nAtoms == 0)
+        continue;
+
+      const real* coord = d == XX ? x : d == YY ? y : z;
+      const auto bounds = std::minmax_element(coord, coord + nAtoms);
+      lower[d] = *bounds.first;
+      extent[d] = *bounds.second - *bounds.first;
+      if(extent[d] <= 0)
+        extent[d] = cutoff;
+      // Keep the atoms at the upper bound inside the last cell
+      extent[d] *= 1.0001;
+    }
+
+    // Heights of the box, perpendicular to the other two vectors
+    const real volume = cellBox[XX][XX] * cellBox[YY][YY] * cellBox[ZZ][ZZ];
+    const rvec height = {
+        volume / norm(cellBox[YY][YY] * cellBox[ZZ][ZZ],
+                      -cellBox[YY][XX] * cellBox[ZZ][ZZ],
+                      cellBox[YY][XX] * cellBox[ZZ][YY]
+                      - cellBox[YY][YY] * cellBox[ZZ][XX]),
+        volume / (cellBox[XX][XX] * norm(0, cellBox[ZZ][ZZ],
+                                         cellBox[ZZ][YY])),
+        cellBox[ZZ][ZZ] };
+
+    for(int d = 0; d < DIM; d++)
+    {
+      const real length = periodic[d] ? height[d] : extent[d];
+      nCells[d] = cutoff > 0 ? static_cast<int>(length / cutoff) : 1;
+      if(nCells[d] < 1)
+        nCells[d] = 1;
+    }
+
+    const unsigned int totalCells = nCells[XX] * nCells[YY] * nCells[ZZ];
+    cellCount.assign(totalCells, 0);
+    cellStart.resize(totalCells + 1);
+    atomCell.resize(nAtoms);
+    atomSlot.resize(nAtoms);
+    sortedAtoms.resize(nAtoms);
+    sortedX.resize(nAtoms);
+    sortedY.resize(nAtoms);
+    sortedZ.resize(nAtoms);
+    wrappedX.resize(nAtoms);
+    wrappedY.resize(nAtoms);
+    wrappedZ.resize(nAtoms);
+
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      rvec pos = { x[i], y[i], z[i] };
+      rvec s;
+
+      // Fractional coordinates, the box is lower triangular
+      s[ZZ] = periodic[ZZ] ? pos[ZZ] / cellBox[ZZ][ZZ]
+                           : (pos[ZZ] - lower[ZZ]) / extent[ZZ];
+      s[YY] = periodic[YY] ? (pos[YY] - (periodic[ZZ] ? s[ZZ] : 0)
+                              * cellBox[ZZ][YY]) / cellBox[YY][YY]
+                           : (pos[YY] - lower[YY]) / extent[YY];
+      s[XX] = periodic[XX] ? (pos[XX] - (periodic[ZZ] ? s[ZZ] : 0)
+                              * cellBox[ZZ][XX] - s[YY] * cellBox[YY][XX])
+                             / cellBox[XX][XX]
+                           : (pos[XX] - lower[XX]) / extent[XX];
+
+      /*
+       * Moving by a box vector only changes its own fractional coordinate,
+       * so every dimension can be wrapped independently.
+       */
+      int c[DIM];
+      for(int d = 0; d < DIM; d++)
+      {
+        if(periodic[d])
+        {
+          const real wrap = std::floor(s[d]);
+          if(wrap != 0)
+          {
+            s[d] -= wrap;
+            for(int n = 0; n <= d; n++)
+              pos[n] -= wrap * cellBox[d][n];
+          }
+        }
+
+        c[d] = static_cast<int>(s[d] * nCells[d]);
+        if(c[d] >= nCells[d])
+          c[d] = nCells[d] - 1;
+        else if(c[d] < 0)
+          c[d] = 0;
+      }
+
+      atomCell[i] = cellIndex(c[XX], c[YY], c[ZZ]);
+      cellCount[atomCell[i]]++;
+      wrappedX[i] = pos[XX];
+      wrappedY[i] = pos[YY];
+      wrappedZ[i] = pos[ZZ];
+    }
+
+    // Counting sort, atoms of the same cell end up contiguous
+    cellStart[0] = 0;
+    for(unsigned int cell = 0; cell < totalCells; cell++)
+      cellStart[cell + 1] = cellStart[cell] + cellCount[cell];
+
+    std::fill(std::begin(cellCount), std::end(cellCount), 0);
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      const unsigned int cell = atomCell[i];
+      const unsigned int slot = cellStart[cell] + cellCount[cell]++;
+      atomSlot[i] = slot;
+      sortedAtoms[slot] = i;
+      sortedX[slot] = wrappedX[i];
+      sortedY[slot] = wrappedY[i];
+      sortedZ[slot] = wrappedZ[i];
+    }
+  }
+}
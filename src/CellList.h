@@ -0,0 +1,145 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CELLLIST_H
+#define _CELLLIST_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <vector>
+#include <array>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  /**
+   * @brief Uniform grid for neighbour searching
+   *
+   * Cells are in box fractional coordinates, without a box they cover the
+   * atoms. Neighbours within the cutoff are in the 27 cells around an atom.
+   */
+  class CellList
+  {
+    public:
+      CellList();
+
+      void build(const real* x, const real* y, const real* z,
+                 unsigned int nAtoms, real cutoff, int ePBC,
+                 const matrix box);
+
+      /**
+       * @brief Calls function(j, dx, dy, dz) for every candidate neighbour
+       *
+       * Distances are to the nearest image, candidates can be farther than
+       * the cutoff.
+       */
+      template<typename Function>
+      void forEachNeighbour(unsigned int atom, Function function) const;
+
+    private:
+      std::array<int, DIM> nCells;
+      std::array<bool, DIM> periodic;
+      matrix cellBox;
+      std::vector<unsigned int> cellStart;
+      std::vector<unsigned int> cellCount;
+      std::vector<unsigned int> atomCell;
+      std::vector<unsigned int> atomSlot;
+      std::vector<real> wrappedX, wrappedY, wrappedZ;
+      // Atoms sorted by cell, wrapped inside the box
+      std::vector<unsigned int> sortedAtoms;
+      std::vector<real> sortedX, sortedY, sortedZ;
+
+      inline unsigned int
+      cellIndex(int cx, int cy, int cz) const
+      {
+        return (cx * nCells[YY] + cy) * nCells[ZZ] + cz;
+      }
+  };
+
+  template<typename Function>
+  void
+  CellList::forEachNeighbour(unsigned int atom, Function function) const
+  {
+    const unsigned int slot = atomSlot[atom];
+    const real ax = sortedX[slot];
+    const real ay = sortedY[slot];
+    const real az = sortedZ[slot];
+    const unsigned int cell = atomCell[atom];
+    const int c[DIM] = { static_cast<int>(cell / nCells[ZZ] / nCells[YY]),
+                         static_cast<int>(cell / nCells[ZZ] % nCells[YY]),
+                         static_cast<int>(cell % nCells[ZZ]) };
+
+    for(int ox = -1; ox <= 1; ox++)
+      for(int oy = -1; oy <= 1; oy++)
+        for(int oz = -1; oz <= 1; oz++)
+        {
+          const int offset[DIM] = { ox, oy, oz };
+          int target[DIM];
+          rvec shift = { 0, 0, 0 };
+          bool valid = true;
+
+          for(int d = 0; d < DIM and valid; d++)
+          {
+            target[d] = c[d] + offset[d];
+            if(target[d] >= 0 and target[d] < nCells[d])
+              continue;
+
+            if(not periodic[d])
+            {
+              valid = false;
+              break;
+            }
+
+            const int wrap = target[d] < 0 ? -1 : 1;
+            target[d] -= wrap * nCells[d];
+            for(int n = 0; n <= d; n++)
+              shift[n] += wrap * cellBox[d][n];
+          }
+
+          if(not valid)
+            continue;
+
+          const unsigned int targetCell = cellIndex(target[XX], target[YY],
+                                                    target[ZZ]);
+          const unsigned int end = cellStart[targetCell + 1];
+          for(unsigned int s = cellStart[targetCell]; s < end; s++)
+          {
+            const unsigned int j = sortedAtoms[s];
+            if(j == atom)
+              continue;
+
+            function(j, sortedX[s] + shift[XX] - ax,
+                     sortedY[s] + shift[YY] - ay,
+                     sortedZ[s] + shift[ZZ] - az);
+          }
+        }
+  }
+}
+
+#endif /* _CELLLIST_H */
@@ -0,0 +1,246 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FrameIndex.h"
+#include "MappedTrajectory.h"
+#include "Serializer.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+
+#if GMXVER < 50
+/* Workaround - is not defined as "C", let's include it before others */
+extern "C"
+{
+#include <gromacs/gmxfio.h>
+}
+
+#include <gromacs/statutil.h>
+#include <gromacs/smalloc.h>
+#else
+#include <gromacs/fileio/trxio.h>
+#include <gromacs/utility/smalloc.h>
+#endif
+
+namespace PstpFinder
+{
+  static constexpr std::uint32_t sidecarMagic = 0x50535058; // "PSPX"
+  static constexpr std::uint32_t sidecarVersion = 1;
+
+  FrameIndex::FrameIndex() :
+      seekable(false)
+  {
+  }
+
+  bool
+  FrameIndex::load(const std::string& trajectoryFileName)
+  {
+    struct stat info;
+    clear();
+    if(stat(trajectoryFileName.c_str(), &info) != 0)
+      return false;
+
+    if(not MappedTrajectory::isSupported(trajectoryFileName))
+      return buildGeneric(trajectoryFileName);
+
+    const std::string sidecar = getSidecarFileName(trajectoryFileName);
+    if(readSidecar(sidecar, info.st_size, info.st_mtime))
+      return true;
+
+    if(not buildMapped(trajectoryFileName))
+      return false;
+
+    // Not being able to cache the index is not an error
+    writeSidecar(sidecar, info.st_size, info.st_mtime);
+    return true;
+  }
+
+  void
+  FrameIndex::clear()
+  {
+    entries.clear();
+    seekable = false;
+  }
+
+  std::size_t
+  FrameIndex::size() const
+  {
+    return entries.size();
+  }
+
+  bool
+  FrameIndex::empty() const
+  {
+    return entries.empty();
+  }
+
+  const FrameIndex::Entry&
+  FrameIndex::operator [](std::size_t frame) const
+  {
+    return entries[frame];
+  }
+
+  const FrameIndex::Entry&
+  FrameIndex::back() const
+  {
+    return entries.back();
+  }
+
+  bool
+  FrameIndex::isSeekable() const
+  {
+    return seekable;
+  }
+
+  std::size_t
+  FrameIndex::find(float time) const
+  {
+    return std::lower_bound(std::begin(entries), std::end(entries), time,
+                            [](const Entry& entry, float value)
+                            {
+                              return entry.time < value;
+                            }) - std::begin(entries);
+  }
+
+  std::string
+  FrameIndex::getSidecarFileName(const std::string& trajectoryFileName)
+  {
+    return trajectoryFileName + ".pstpidx";
+  }
+
+  bool
+  FrameIndex::buildMapped(const std::string& fileName)
+  {
+    MappedTrajectory trajectory(fileName);
+    if(not trajectory.isOpen())
+      return false;
+
+    // A truncated last frame can't be read, the scan stops there
+    MappedTrajectory::Header header;
+    while(trajectory.skip(header))
+    {
+      // Frames without coordinates are never returned by GROMACS
+      if(not header.hasX)
+        continue;
+
+      Entry entry;
+      entry.offset = header.offset;
+      entry.time = header.time;
+      entry.step = header.step;
+      entries.push_back(entry);
+    }
+
+    seekable = true;
+    return not entries.empty();
+  }
+
+  bool
+  FrameIndex::buildGeneric(const std::string& fileName)
+  {
+    output_env_t oenv;
+    t_trxstatus* status;
+    t_trxframe fr;
+
+#if GMXVER < 50
+    snew(oenv, 1);
+    output_env_init_default(oenv);
+#else
+    output_env_init_default(&oenv);
+#endif
+
+    if(not read_first_frame(oenv, &status, fileName.c_str(), &fr, 0))
+    {
+      output_env_done(oenv);
+      return false;
+    }
+
+    do
+    {
+      Entry entry;
+      entry.offset = -1;
+      entry.time = fr.time;
+      entry.step = fr.step;
+      entries.push_back(entry);
+    }
+    while(read_next_frame(oenv, status, &fr));
+
+    close_trx(status);
+    output_env_done(oenv);
+
+    seekable = false;
+    return true;
+  }
+
+  bool
+  FrameIndex::readSidecar(const std::string& fileName, std::int64_t fileSize,
+                          std::int64_t modificationTime)
+  {
+    std::ifstream stream(fileName, std::ios_base::in | std::ios_base::binary);
+    if(not stream)
+      return false;
+
+    Serializer<std::ifstream> serializer(stream);
+    std::uint32_t magic, version;
+    std::int64_t size, mtime;
+    serializer >> magic >> version >> size >> mtime;
+    if(not stream or magic != sidecarMagic or version != sidecarVersion
+       or size != fileSize or mtime != modificationTime)
+      return false;
+
+    serializer >> entries;
+    if(not stream or entries.empty())
+    {
+      entries.clear();
+      return false;
+    }
+
+    seekable = true;
+    return true;
+  }
+
+  void
+  FrameIndex::writeSidecar(const std::string& fileName, std::int64_t fileSize,
+                           std::int64_t modificationTime) const
+  {
+    // Written aside and renamed, a reader never sees a partial index
+    const std::string temporary = fileName + ".tmp";
+    {
+      std::ofstream stream(temporary, std::ios_base::out
+                                      | std::ios_base::binary
+                                      | std::ios_base::trunc);
+      if(not stream)
+        return;
+
+      Serializer<std::ofstream> serializer(stream);
+      serializer << sidecarMagic << sidecarVersion << fileSize
+                 << modificationTime << entries;
+      if(not stream.flush())
+      {
+        stream.close();
+        std::remove(temporary.c_str());
+        return;
+      }
+    }
+
+    if(std::rename(temporary.c_str(), fileName.c_str()) != 0)
+      std::remove(temporary.c_str());
+  }
+}
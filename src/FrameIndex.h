@@ -0,0 +1,100 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAMEINDEX_H
+#define _FRAMEINDEX_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Offset, time and step of every frame of a trajectory
+   *
+   * XTC and TRR indexes are cached in trajectory name + ".pstpidx", other
+   * formats are indexed in memory only and have no offsets.
+   */
+  class FrameIndex
+  {
+    public:
+      struct Entry
+      {
+        // Byte offset of the frame, -1 when unknown
+        std::int64_t offset;
+        float time;
+        std::int64_t step;
+
+        template<typename Serializer>
+        void serialize(Serializer serializer);
+      };
+
+      FrameIndex();
+
+      /**
+       * @brief Loads the index from the sidecar file or builds it
+       * @return false if the trajectory can't be read
+       */
+      bool load(const std::string& trajectoryFileName);
+      void clear();
+
+      std::size_t size() const;
+      bool empty() const;
+      const Entry& operator [](std::size_t frame) const;
+      const Entry& back() const;
+
+      /**
+       * @brief Whether frames can be reached using their offset
+       */
+      bool isSeekable() const;
+
+      /**
+       * @brief Index of the first frame not earlier than time, or size()
+       */
+      std::size_t find(float time) const;
+
+      static std::string getSidecarFileName(
+          const std::string& trajectoryFileName);
+
+    private:
+      std::vector<Entry> entries;
+      bool seekable;
+
+      bool buildMapped(const std::string& fileName);
+      bool buildGeneric(const std::string& fileName);
+      bool readSidecar(const std::string& fileName, std::int64_t fileSize,
+                       std::int64_t modificationTime);
+      void writeSidecar(const std::string& fileName, std::int64_t fileSize,
+                        std::int64_t modificationTime) const;
+  };
+
+  template<typename Serializer>
+  void
+  FrameIndex::Entry::serialize(Serializer serializer)
+  {
+    serializer & offset & time & step;
+  }
+}
+
+#endif /* _FRAMEINDEX_H */
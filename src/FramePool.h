@@ -0,0 +1,112 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAMEPOOL_H
+#define _FRAMEPOOL_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cassert>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Recycles fixed size frames of T, from any thread
+   *
+   * All the frames are freed with the pool, released or not.
+   */
+  template<typename T>
+  class FramePool
+  {
+    public:
+      FramePool(std::size_t frameSize = 0);
+      FramePool(const FramePool&) = delete;
+      FramePool& operator =(const FramePool&) = delete;
+
+      /**
+       * @brief Sets the size of the frames, before the first acquire()
+       */
+      void setFrameSize(std::size_t frameSize);
+      std::size_t getFrameSize() const;
+
+      T* acquire();
+      void release(T* frame);
+
+    private:
+      std::size_t frameSize;
+      std::vector<std::unique_ptr<T[]>> frames;
+      std::vector<T*> released;
+      mutable std::mutex poolMutex;
+  };
+
+  template<typename T>
+  FramePool<T>::FramePool(std::size_t frameSize) :
+      frameSize(frameSize)
+  {
+  }
+
+  template<typename T>
+  void
+  FramePool<T>::setFrameSize(std::size_t frameSize)
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    assert(frames.empty() or frameSize == this->frameSize);
+    this->frameSize = frameSize;
+  }
+
+  template<typename T>
+  std::size_t
+  FramePool<T>::getFrameSize() const
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    return frameSize;
+  }
+
+  template<typename T>
+  T*
+  FramePool<T>::acquire()
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if(not released.empty())
+    {
+      T* frame = released.back();
+      released.pop_back();
+      return frame;
+    }
+
+    frames.emplace_back(new T[frameSize]);
+    // A released frame will always find room
+    released.reserve(frames.size());
+    return frames.back().get();
+  }
+
+  template<typename T>
+  void
+  FramePool<T>::release(T* frame)
+  {
+    if(not frame)
+      return;
+
+    std::lock_guard<std::mutex> lock(poolMutex);
+    released.push_back(frame);
+  }
+}
+
+#endif /* _FRAMEPOOL_H */
@@ -0,0 +1,88 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FramePrefetcher.h"
+
+#include <algorithm>
+
+namespace PstpFinder
+{
+  FramePrefetcher::FramePrefetcher(const t_trxframe& model,
+                                   unsigned int depth, Source source) :
+      model(model), source(std::move(source)), pool(depth > 0 ? depth : 1),
+      freeFrames(pool.size()), readyFrames(pool.size())
+  {
+    for(unsigned int i = 0; i < pool.size(); i++)
+    {
+      pool[i].x.resize(model.natoms * DIM);
+      freeFrames.push(std::move(i));
+    }
+
+    thread = std::thread(&FramePrefetcher::prefetch, this);
+  }
+
+  FramePrefetcher::~FramePrefetcher()
+  {
+    freeFrames.close();
+    readyFrames.close();
+    thread.join();
+  }
+
+  bool
+  FramePrefetcher::next(t_trxframe& frame)
+  {
+    unsigned int slot;
+    if(not readyFrames.pop(slot))
+      return false;
+
+    const TrajectoryFrame& read = pool[slot];
+    std::copy(std::begin(read.x), std::end(read.x), frame.x[0]);
+    std::copy(read.box[0], read.box[0] + DIM * DIM, frame.box[0]);
+    frame.time = read.time;
+    frame.step = read.step;
+
+    freeFrames.push(std::move(slot));
+    return true;
+  }
+
+  void
+  FramePrefetcher::prefetch()
+  {
+    t_trxframe frame = model;
+    unsigned int slot;
+
+    while(freeFrames.pop(slot))
+    {
+      // Read straight into the pool
+      TrajectoryFrame& read = pool[slot];
+      frame.x = reinterpret_cast<rvec*>(read.x.data());
+      if(not source(frame))
+        break;
+
+      std::copy(frame.box[0], frame.box[0] + DIM * DIM, read.box[0]);
+      read.time = frame.time;
+      read.step = frame.step;
+      if(not readyFrames.push(std::move(slot)))
+        break;
+    }
+
+    // Frames already queued can still be taken
+    readyFrames.close();
+  }
+}
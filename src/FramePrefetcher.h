@@ -0,0 +1,74 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FRAMEPREFETCHER_H
+#define _FRAMEPREFETCHER_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "BoundedQueue.h"
+#include "ParallelTrajectoryReader.h"
+
+#include <vector>
+#include <thread>
+#include <functional>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Reads frames ahead on its own thread
+   *
+   * Frames are read with source, like read_next_frame, into a pool of depth
+   * frames. Nobody else must touch the trajectory meanwhile.
+   */
+  class FramePrefetcher
+  {
+    public:
+      typedef std::function<bool(t_trxframe&)> Source;
+
+      /**
+       * @param model Frame used to read, only its x is replaced
+       */
+      FramePrefetcher(const t_trxframe& model, unsigned int depth,
+                      Source source);
+      ~FramePrefetcher();
+      FramePrefetcher(const FramePrefetcher&) = delete;
+      FramePrefetcher& operator =(const FramePrefetcher&) = delete;
+
+      /**
+       * @brief Copies the next frame in frame
+       * @return false at the end of the trajectory
+       */
+      bool next(t_trxframe& frame);
+
+    private:
+      const t_trxframe model;
+      const Source source;
+      std::vector<TrajectoryFrame> pool;
+      BoundedQueue<unsigned int> freeFrames;
+      BoundedQueue<unsigned int> readyFrames;
+      std::thread thread;
+
+      void prefetch();
+  };
+}
+
+#endif /* _FRAMEPREFETCHER_H */
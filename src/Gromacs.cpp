@@ -22,14 +22,31 @@
 #include "SasAnalysis.h"
 #include "utils.h"
 #include "Protein.h"
+#include "BoundedQueue.h"
+#include "SasCalculator.h"
+#include "CellList.h"
+#include "StructureAverager.h"
+#include "ParallelTrajectoryReader.h"
+#include "MappedTrajectory.h"
+#include "FramePrefetcher.h"
+#include "FrameIndex.h"
 
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <cstring>
+#include <cmath>
 #include <mutex>
+#include <memory>
+#include <limits>
 
 #if GMXVER < 50
+/* Workaround - is not defined as "C", let's include it before others */
+extern "C"
+{
+#include <gromacs/gmxfio.h>
+}
+
 #include <gromacs/tpxio.h>
 #include <gromacs/mtop_util.h>
 #include <gromacs/main.h>
@@ -49,6 +66,7 @@
 #include <gromacs/math/do_fit.h>
 #include <gromacs/fileio/confio.h>
 #include <gromacs/fileio/tpxio.h>
+#include <gromacs/fileio/gmxfio.h>
 
 #include <gromacs/legacyheaders/rmpbc.h>
 #include <gromacs/legacyheaders/gmx_fatal.h>
@@ -60,6 +78,267 @@ namespace PstpFinder
 {
   static std::mutex nsc_dclm_pbc_mutex;
 
+  struct SasFrame
+  {
+    unsigned int index;
+    std::vector<real> x;
+    matrix box;
+    // Original ids of the atoms in x, when only the neighbourhood is copied
+    std::vector<atom_id> atoms;
+  };
+
+  /*
+   * Copies the SAS target atoms, followed by the candidates closer than the
+   * cutoff to any of them, in a compact buffer. This avoids touching (and
+   * unwrapping) the whole system, usually mostly solvent.
+   */
+  class NeighbourhoodSearch
+  {
+    public:
+      NeighbourhoodSearch(const std::vector<atom_id>& target,
+                          const std::vector<atom_id>& candidates,
+                          real cutoff) :
+          target(target), candidates(candidates), cutoff(cutoff) {}
+
+      void
+      extract(const rvec* x, int ePBC, const matrix box, SasFrame& frame)
+      {
+        const unsigned int nTarget = target.size();
+        const unsigned int nCandidates = cutoff > 0 ? candidates.size() : 0;
+        const unsigned int nAtoms = nTarget + nCandidates;
+
+        atomX.resize(nAtoms);
+        atomY.resize(nAtoms);
+        atomZ.resize(nAtoms);
+        for(unsigned int i = 0; i < nAtoms; i++)
+        {
+          const atom_id id = i < nTarget ? target[i]
+                                         : candidates[i - nTarget];
+          atomX[i] = x[id][XX];
+          atomY[i] = x[id][YY];
+          atomZ[i] = x[id][ZZ];
+        }
+
+        frame.atoms = target;
+        if(nCandidates > 0)
+        {
+          const real cutoff2 = cutoff * cutoff;
+          cellList.build(atomX.data(), atomY.data(), atomZ.data(), nAtoms,
+                         cutoff, ePBC, box);
+          for(unsigned int i = nTarget; i < nAtoms; i++)
+          {
+            bool isNear = false;
+            cellList.forEachNeighbour(i, [&](unsigned int j, real dx,
+                                             real dy, real dz)
+            {
+              if(j < nTarget and dx * dx + dy * dy + dz * dz < cutoff2)
+                isNear = true;
+            });
+
+            if(isNear)
+              frame.atoms.push_back(candidates[i - nTarget]);
+          }
+        }
+
+        frame.x.resize(frame.atoms.size() * DIM);
+        for(unsigned int i = 0; i < frame.atoms.size(); i++)
+          std::copy(x[frame.atoms[i]], x[frame.atoms[i]] + DIM,
+                    frame.x.data() + i * DIM);
+
+        if(box)
+          makeWhole(reinterpret_cast<rvec*>(frame.x.data()), nTarget, ePBC,
+                    box);
+      }
+
+    private:
+      const std::vector<atom_id>& target;
+      const std::vector<atom_id>& candidates;
+      const real cutoff;
+      CellList cellList;
+      std::vector<real> atomX, atomY, atomZ;
+
+      /*
+       * Without the molecule graph used by gmx_rmpbc, every atom is moved to
+       * the image nearest to the previous one. Consecutive atoms of a protein
+       * are always near each other, so this is enough to make it whole.
+       */
+      static void
+      makeWhole(rvec* x, unsigned int nAtoms, int ePBC, const matrix box)
+      {
+        const int periodicDims = ePBC == epbcNONE ? 0 :
+                                 ePBC == epbcXY ? 2 : 3;
+
+        for(unsigned int i = 1; i < nAtoms; i++)
+        {
+          rvec d;
+          rvec_sub(x[i], x[i - 1], d);
+          for(int m = periodicDims - 1; m >= 0; m--)
+          {
+            const real shift = std::round(d[m] / box[m][m]);
+            if(shift != 0)
+              for(int n = 0; n <= m; n++)
+              {
+                d[n] -= shift * box[m][n];
+                x[i][n] -= shift * box[m][n];
+              }
+          }
+        }
+      }
+  };
+
+  /*
+   * When calculator is nullptr the legacy GROMACS nsc_dclm_pbc is used. It
+   * keeps global state, so it must be serialized. Without ids, atoms of x
+   * are the same ones every frame.
+   */
+  static real
+  calculateFrameSas(rvec* x, matrix box, gmx_rmpbc_t gpbc, int natoms,
+                    int ePBC, bool usePBC, real* radius,
+                    std::vector<atom_id>& index,
+                    const std::vector<atom_id>& occluders,
+                    const real* dgs_factor, unsigned int nDots,
+                    SasCalculator* calculator, SasAtom* atoms,
+                    const atom_id* ids = nullptr)
+  {
+    real totarea, totvolume;
+    int nsurfacedots;
+    real *area = 0, *surfacedots = 0, dgsolv = 0;
+    const int nx = index.size();
+
+    // Without gpbc coordinates have already been made whole
+    if(usePBC and gpbc)
+      gmx_rmpbc(gpbc, natoms, box, x);
+
+    if(calculator)
+      area = const_cast<real*>(calculator->calculate(x, radius, index,
+                                                     occluders, ePBC,
+                                                     usePBC ? box : nullptr,
+                                                     ids).data());
+    else
+    {
+      // Areas are returned in index order, scored atoms come first
+      std::vector<atom_id> fullIndex;
+      if(not occluders.empty())
+      {
+        fullIndex = index;
+        fullIndex.insert(std::end(fullIndex), std::begin(occluders),
+                         std::end(occluders));
+      }
+      std::vector<atom_id>& nscIndex = occluders.empty() ? index : fullIndex;
+
+      int nsc_dclm_pdc_result;
+      {
+        std::unique_lock<std::mutex> lock(nsc_dclm_pbc_mutex);
+        nsc_dclm_pdc_result = gmx_legacy::nsc_dclm_pbc(x, radius,
+                nscIndex.size(), nDots, FLAG_ATOM_AREA, &totarea, &area,
+                &totvolume, &surfacedots, &nsurfacedots, nscIndex.data(),
+                ePBC, usePBC ? box : nullptr);
+      }
+      if(nsc_dclm_pdc_result != 0)
+        gmx_fatal(FARGS, "Something wrong in nsc_dclm_pbc");
+    }
+
+    for(int i = 0; i < nx; i++)
+    {
+      SasAtom& atom = atoms[i];
+      atom.x = x[index[i]][0];
+      atom.y = x[index[i]][1];
+      atom.z = x[index[i]][2];
+      atom.sas = area[i];
+
+      if(dgs_factor)
+        dgsolv += area[i] * dgs_factor[i];
+    }
+
+    if(not calculator and area)
+      sfree(area);
+    if(surfacedots)
+      sfree(surfacedots);
+
+    return dgsolv;
+  }
+
+  static gmx_rmpbc_t
+  initRmpbc(t_topology& top, int ePBC, int natoms, matrix box, bool usePBC)
+  {
+    if(not usePBC)
+      return nullptr;
+
+#if GMXVER < 50
+    return gmx_rmpbc_init(&top.idef, ePBC, natoms, box);
+#else
+    (void) box;
+    return gmx_rmpbc_init(&top.idef, ePBC, natoms);
+#endif
+  }
+
+  /*
+   * Warm-up frames are refined everywhere, the others wait for the mean
+   * area of the warm-up ones. The mean is left unset on abort.
+   */
+  static void
+  setAdaptiveMean(SasCalculator& calculator, SasMeanArea& meanArea,
+                  unsigned int frame, const bool& abortFlag)
+  {
+    if(meanArea.isWarmup(frame))
+      calculator.setMeanArea(nullptr);
+    else
+      calculator.setMeanArea(meanArea.get([&]() { return abortFlag; }));
+  }
+
+  static void
+  addWarmupFrame(SasMeanArea& meanArea, unsigned int frame,
+                 const SasAtom* atoms, unsigned int nAtoms)
+  {
+    if(not meanArea.isWarmup(frame))
+      return;
+
+    std::vector<real> areas(nAtoms);
+    for(unsigned int i = 0; i < nAtoms; i++)
+      areas[i] = atoms[i].sas;
+    meanArea.add(frame, std::move(areas));
+  }
+
+  // Buffers of a compact frame, kept between frames to avoid allocations
+  struct CompactScratch
+  {
+    std::vector<real> radius;
+    std::vector<atom_id> target;
+    std::vector<atom_id> occluders;
+  };
+
+  /*
+   * Same as above, for a frame holding only the neighbourhood of the target.
+   * Target atoms come first in the frame, the others only bury them.
+   */
+  static real
+  calculateFrameSas(SasFrame& frame, int ePBC, bool usePBC,
+                    const real* radius, unsigned int nTarget,
+                    const real* dgs_factor, unsigned int nDots,
+                    SasCalculator* calculator, CompactScratch& scratch,
+                    SasAtom* atoms)
+  {
+    const unsigned int nAtoms = frame.atoms.size();
+    scratch.radius.resize(nAtoms);
+    scratch.target.resize(nTarget);
+    scratch.occluders.resize(nAtoms - nTarget);
+
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      scratch.radius[i] = radius[frame.atoms[i]];
+      if(i < nTarget)
+        scratch.target[i] = i;
+      else
+        scratch.occluders[i - nTarget] = i;
+    }
+
+    return calculateFrameSas(reinterpret_cast<rvec*>(frame.x.data()),
+                             frame.box, nullptr, nAtoms, ePBC, usePBC,
+                             scratch.radius.data(), scratch.target,
+                             scratch.occluders, dgs_factor, nDots,
+                             calculator, atoms, frame.atoms.data());
+  }
+
   Gromacs::Gromacs(float solventSize)
   {
     init(solventSize);
@@ -81,6 +360,17 @@ namespace PstpFinder
     tprName = gromacs.tprName;
     sasTarget = gromacs.sasTarget;
     _usePBC = gromacs._usePBC;
+    _sasThreads = gromacs._sasThreads;
+    _useLegacySas = gromacs._useLegacySas;
+    _incrementalSas = gromacs._incrementalSas;
+    _sasDots = gromacs._sasDots;
+    _adaptiveSas = gromacs._adaptiveSas;
+    _compactSas = gromacs._compactSas;
+    _compactSasCutoff = gromacs._compactSasCutoff;
+    _decodeThreads = gromacs._decodeThreads;
+    _mapTrajectory = gromacs._mapTrajectory;
+    _prefetchFrames = gromacs._prefetchFrames;
+    _sasStride = gromacs._sasStride;
 
     cachedNFrames = gromacs.cachedNFrames;
     averageStructure = gromacs.averageStructure;
@@ -112,6 +402,22 @@ namespace PstpFinder
     timeStepCached = 0;
     abortFlag = false;
     _usePBC = true;
+    _sasThreads = std::thread::hardware_concurrency();
+    if(_sasThreads == 0)
+      _sasThreads = 1;
+    _useLegacySas = true;
+    _incrementalSas = false;
+    _sasDots = 24;
+    _adaptiveSas = false;
+    _compactSas = false;
+    _compactSasCutoff = 0.6;
+    _decodeThreads = 1;
+    _mapTrajectory = true;
+    _prefetchFrames = 4;
+    _sasStride = 1;
+    nextTrajectoryFrame = 0;
+    prefetchStride = 1;
+    frameIndexLoaded = false;
 
     // Damn it! I can't handle errors raised inside this f*****g function,
     // because it simply crashes on a ERROR HANDLING FUNCTION, overriding
@@ -126,6 +432,9 @@ namespace PstpFinder
 #if GMXVER >= 45
     if(gotTrajectory)
     {
+      prefetcher.reset();
+      trajectoryReader.reset();
+      mappedTrajectory.reset();
       output_env_done(oenv);
       close_trx(status);
     }
@@ -141,7 +450,17 @@ namespace PstpFinder
   Gromacs::calculateSas(Session<Stream>& session)
   {
     operationThread = std::thread(
-       std::bind(&Gromacs::__calculateSas<Stream>, std::ref(*this), std::ref(session)));
+       std::bind(&Gromacs::__calculateSas<Stream>, std::ref(*this),
+                 std::ref(session), nullptr));
+  }
+
+  template<typename Stream>
+  void
+  Gromacs::calculateSasAndAverageStructure(Session<Stream>& session)
+  {
+    operationThread = std::thread(
+       std::bind(&Gromacs::__calculateSasAndAverageStructure<Stream>,
+                 std::ref(*this), std::ref(session)));
   }
 
   void
@@ -160,12 +479,31 @@ namespace PstpFinder
 
   template<typename Stream>
   void
-  Gromacs::__calculateSas(Session<Stream>& session)
+  Gromacs::__calculateSasAndAverageStructure(Session<Stream>& session)
+  {
+    averageStructure = Protein<>();
+
+    if(not gotTopology and not getTopology())
+      gmx_fatal(FARGS, "Could not read topology file.\n");
+
+    if(not gotTrajectory and not getTrajectory())
+      gmx_fatal(FARGS, "Could not read coordinates from statusfile.\n");
+
+    std::vector<atom_id> index(getGroup("Protein"));
+    StructureAverager averager(top, xtop, natoms, index);
+
+    __calculateSas(session, &averager);
+    if(not abortFlag)
+      buildAverageStructure(averager, index);
+  }
+
+  template<typename Stream>
+  void
+  Gromacs::__calculateSas(Session<Stream>& session,
+                          StructureAverager* averager)
   {
     bool bDGsol;
-    real totarea, totvolume;
-    int nsurfacedots;
-    real *dgs_factor, *radius, *area = 0, *surfacedots = 0, dgsolv;
+    real *dgs_factor = nullptr, *radius;
     std::vector<atom_id> index;
     gmx_rmpbc_t gpbc = nullptr;
     int nx;
@@ -191,17 +529,45 @@ namespace PstpFinder
     index = getGroup("Protein");
     nx = index.size();
 
+    /*
+     * In compact mode only the target and the non-solvent atoms around it
+     * are used, so radii are needed just for them.
+     */
+    std::vector<atom_id> candidates;
+    if(_compactSas)
+    {
+      std::vector<atom_id> nonWater(getGroup("non-Water"));
+      std::vector<atom_id> sortedIndex(index);
+      std::sort(std::begin(nonWater), std::end(nonWater));
+      std::sort(std::begin(sortedIndex), std::end(sortedIndex));
+      std::set_difference(std::begin(nonWater), std::end(nonWater),
+                          std::begin(sortedIndex), std::end(sortedIndex),
+                          std::back_inserter(candidates));
+    }
+
     if(bDGsol)
       dgs_factor = new real[nx];
     radius = new real[natoms];
 
-    for(int i = 0; i < natoms; i++)
+    auto queryRadius = [&](int i)
     {
       gmx_atomprop_query(aps, epropVDW,
                          *(top.atoms.resinfo[top.atoms.atom[i].resind].name),
                          *(top.atoms.atomname[i]), radius + i);
       radius[i] += solSize;
+    };
+
+    if(_compactSas)
+    {
+      std::fill(radius, radius + natoms, 0);
+      for(atom_id i : index)
+        queryRadius(i);
+      for(atom_id i : candidates)
+        queryRadius(i);
     }
+    else
+      for(int i = 0; i < natoms; i++)
+        queryRadius(i);
 
     if(bDGsol)
     {
@@ -216,91 +582,173 @@ namespace PstpFinder
       }
     }
 
-    if(_usePBC)
-#if GMXVER < 50
-      gpbc = gmx_rmpbc_init(&top.idef, ePBC, natoms, fr.box);
-#else
-      gpbc = gmx_rmpbc_init(&top.idef, ePBC, natoms);
-#endif
+    /*
+     * Frames averaged by this thread are made whole here, unless
+     * calculateFrameSas already did it with the same gpbc.
+     */
+    if(averager or not _compactSas)
+      gpbc = initRmpbc(top, ePBC, natoms, fr.box, _usePBC);
+    std::function<void(unsigned int)> average;
+    if(averager)
+      average = [&](unsigned int trajectoryFrame)
+      {
+        if(gpbc)
+          gmx_rmpbc(gpbc, natoms, fr.box, fr.x);
+        averager->addFrame(fr.x, trajectoryFrame);
+      };
 
+    const bool pipeline = _sasThreads > 1 and not bDGsol;
     SasAnalysis<Stream> sasAnalysis(nx, *this, session);
+    std::unique_ptr<AverageSnapshots> snapshots;
     {
       unsigned int readFrames(sasAnalysis.getReadFrames());
-      while(readFrames > currentFrame)
+      unsigned int firstSasFrame = 0;
+      /*
+       * Frames whose SAS is stored are not needed at all, but for averaging:
+       * the trajectory is moved right after them through its FrameIndex, or
+       * after the last checkpoint of the average structure.
+       */
+      if(readFrames > 0 and getFrameIndex().isSeekable())
       {
-        //gmx_rmpbc(gpbc, natoms, box, x);
-        operationMutex.lock();
-        currentFrame++;
-        wakeCondition.notify_all();
-        operationMutex.unlock();
-        if(not readNextX())
-          break;
+        AverageCheckpoint checkpoint;
+        if(not averager)
+          firstSasFrame = readFrames;
+        else if(checkpoint.load(session.getFileName(),
+                                session.getSasOffset(), nx)
+                and checkpoint.getSasFrames() <= readFrames
+                and checkpoint.getState().count
+                    == checkpoint.getSasFrames() * _sasStride)
+        {
+          firstSasFrame = checkpoint.getSasFrames();
+          averager->setState(checkpoint.getState());
+        }
       }
-    }
 
-    do
-    {
-      if(abortFlag)
+      if(firstSasFrame > 0)
       {
-        session.abort();
-        break;
+        const unsigned int skipped = firstSasFrame * _sasStride;
+        operationMutex.lock();
+        currentFrame += skipped;
+        wakeCondition.notify_all();
+        operationMutex.unlock();
+        if(not readFrame(nextTrajectoryFrame - 1 + skipped, _sasStride))
+          readyToGetX = false;
+        readFrames -= firstSasFrame;
       }
-      if(_usePBC)
-        gmx_rmpbc(gpbc, natoms, fr.box, fr.x);
 
-      int nsc_dclm_pdc_result;
+      // Pipeline workers average full frames on their own
+      if(averager)
+        snapshots.reset(new AverageSnapshots(
+            pipeline and not _compactSas ? _sasThreads + 1 : 1,
+            firstSasFrame, _sasStride, SAS_AVERAGE_CHECKPOINT_FRAMES,
+            [&](AverageCheckpoint&& checkpoint)
+            {
+              sasAnalysis.addAverageCheckpoint(std::move(checkpoint));
+            }));
+
+      for(unsigned int frame = 0; frame < readFrames; frame++)
       {
-        std::unique_lock<std::mutex> lock(nsc_dclm_pbc_mutex);
-        nsc_dclm_pdc_result = gmx_legacy::nsc_dclm_pbc(fr.x, radius, nx, 24,
-                FLAG_ATOM_AREA, &totarea, &area, &totvolume, &surfacedots,
-                &nsurfacedots, index.data(), ePBC, _usePBC ? fr.box : nullptr);
-      }
-      if(nsc_dclm_pdc_result != 0)
-        gmx_fatal(FARGS, "Something wrong in nsc_dclm_pbc");
+        // SAS of these frames is already stored, averaging still needs them
+        const unsigned int trajectoryFrame = currentFrame;
+        if(average)
+        {
+          snapshots->reach(0, trajectoryFrame, averager->getState());
+          average(trajectoryFrame);
+        }
 
-      std::vector<SasAtom> atoms;
-      atoms.reserve(nx);
-      dgsolv = 0;
-      for(int i = 0; i < nx; i++)
-      {
-        SasAtom atom;
-        atom.x = fr.x[index[i]][0];
-        atom.y = fr.x[index[i]][1];
-        atom.z = fr.x[index[i]][2];
-        atom.sas = area[i];
-        atoms.push_back(std::move(atom));
-
-        if(bDGsol)
-          dgsolv += area[i] * dgs_factor[i];
-      }
-      if(abortFlag)
-      {
-        session.abort();
-        break;
+        operationMutex.lock();
+        currentFrame += _sasStride;
+        wakeCondition.notify_all();
+        operationMutex.unlock();
+        if(not readNextSasX(average, trajectoryFrame))
+          break;
       }
+    }
 
+    // Frames go to the writer without copies and come back to the pool
+    FramePool<SasAtom>& framePool = sasAnalysis.getFramePool();
+    auto writeFrame = [&](SasAtom* atoms)
+    {
       operationMutex.lock();
       sasAnalysis.write(atoms);
-      currentFrame++;
+      currentFrame += _sasStride;
       wakeCondition.notify_all();
       operationMutex.unlock();
+    };
 
-      if(area)
-      {
-        sfree(area);
-        area = NULL;
-      }
-      if(surfacedots)
+    if(pipeline)
+      sasPipeline(radius, index, candidates, averager, average,
+                  snapshots.get(), framePool, writeFrame);
+    else
+    {
+      SasCalculator calculator(_sasDots);
+      calculator.setIncremental(_incrementalSas);
+      calculator.setAdaptive(_adaptiveSas);
+      const bool adaptive = _adaptiveSas and not _useLegacySas;
+      SasMeanArea meanArea;
+      NeighbourhoodSearch neighbourhood(index, candidates, _compactSasCutoff);
+      SasFrame frame;
+      CompactScratch scratch;
+      const std::vector<atom_id> noOccluders;
+      unsigned int frameIndex = 0;
+      unsigned int trajectoryFrame;
+      do
       {
-        sfree(surfacedots);
-        surfacedots = NULL;
+        if(abortFlag)
+          break;
+
+        trajectoryFrame = currentFrame;
+        if(snapshots)
+          snapshots->reach(0, trajectoryFrame, averager->getState());
+        SasAtom* atoms = framePool.acquire();
+        if(adaptive)
+          setAdaptiveMean(calculator, meanArea, frameIndex, abortFlag);
+        if(_compactSas)
+        {
+          neighbourhood.extract(fr.x, ePBC, _usePBC ? fr.box : nullptr,
+                                frame);
+          copy_mat(fr.box, frame.box);
+          calculateFrameSas(frame, ePBC, _usePBC, radius, nx, dgs_factor,
+                            _sasDots, _useLegacySas ? nullptr : &calculator,
+                            scratch, atoms);
+        }
+        else
+          calculateFrameSas(fr.x, fr.box, gpbc, natoms, ePBC, _usePBC,
+                            radius, index, noOccluders, dgs_factor,
+                            _sasDots, _useLegacySas ? nullptr : &calculator,
+                            atoms);
+        if(abortFlag)
+        {
+          framePool.release(atoms);
+          break;
+        }
+
+        if(adaptive)
+          addWarmupFrame(meanArea, frameIndex, atoms, nx);
+        frameIndex++;
+        writeFrame(atoms);
+
+        // SAS is done with this frame, now it can be fitted in place
+        if(averager and _compactSas)
+          average(trajectoryFrame);
+        else if(averager)
+          averager->addFrame(fr.x, trajectoryFrame);
       }
+      while(readNextSasX(average, trajectoryFrame));
+
+      if(snapshots)
+        snapshots->finish(0, averager->getState());
     }
-    while(readNextX());
 
-    if(_usePBC)
+    if(gpbc)
       gmx_rmpbc_done(gpbc);
 
+    if(abortFlag)
+      session.abort();
+
+    prefetcher.reset();
+    trajectoryReader.reset();
+    mappedTrajectory.reset();
     output_env_done(oenv);
     close_trx(status);
     gotTrajectory = false;
@@ -310,18 +758,238 @@ namespace PstpFinder
     delete[] radius;
   }
 
+  void
+  Gromacs::sasPipeline(const real* radius, std::vector<atom_id>& index,
+                       const std::vector<atom_id>& candidates,
+                       StructureAverager* averager,
+                       const std::function<void(unsigned int)>& average,
+                       AverageSnapshots* snapshots,
+                       FramePool<SasAtom>& framePool,
+                       const std::function<void(SasAtom*)>& writeFrame)
+  {
+    const unsigned int maxInFlight = _sasThreads * 4;
+    BoundedQueue<SasFrame> frames(_sasThreads * 2);
+    // Frames done with go back to the reader, never more than in flight
+    BoundedQueue<SasFrame> spareFrames(maxInFlight + _sasThreads);
+    // Never more than maxInFlight frames are pending, each has its own slot
+    std::vector<SasAtom*> pending(maxInFlight, nullptr);
+    std::mutex pendingMutex;
+    std::condition_variable pendingCondition;
+    unsigned int nextToWrite = 0;
+    const unsigned int firstFrame = currentFrame;
+
+    /*
+     * Workers own a full copy of the frame, so they can also do the
+     * averaging on their own. Compact frames are partial and are averaged by
+     * the reader.
+     */
+    // Adaptive areas must not depend on which worker got which frame
+    const bool adaptive = _adaptiveSas and not _useLegacySas;
+    SasMeanArea meanArea;
+
+    std::vector<std::unique_ptr<StructureAverager>> partials;
+    if(averager and not _compactSas)
+      for(unsigned int i = 0; i < _sasThreads; i++)
+        partials.emplace_back(new StructureAverager(top, xtop, natoms,
+                                                    index));
+
+    auto worker = [&](StructureAverager* partial, unsigned int contributor)
+    {
+      gmx_rmpbc_t gpbc = nullptr;
+      if(not _compactSas)
+        gpbc = initRmpbc(top, ePBC, natoms, fr.box, _usePBC);
+      // nsc_dclm_pbc does not touch radius, it is only not const-correct
+      std::vector<real> workerRadius(radius, radius + natoms);
+      SasCalculator calculator(_sasDots);
+      calculator.setIncremental(_incrementalSas);
+      calculator.setAdaptive(_adaptiveSas);
+      CompactScratch scratch;
+      const std::vector<atom_id> noOccluders;
+
+      SasFrame frame;
+      while(frames.pop(frame))
+      {
+        SasAtom* atoms = framePool.acquire();
+        if(adaptive and not abortFlag)
+          setAdaptiveMean(calculator, meanArea, frame.index, abortFlag);
+        if(not abortFlag)
+        {
+          if(_compactSas)
+            calculateFrameSas(frame, ePBC, _usePBC, radius, index.size(),
+                              nullptr, _sasDots,
+                              _useLegacySas ? nullptr : &calculator, scratch,
+                              atoms);
+          else
+            calculateFrameSas(reinterpret_cast<rvec*>(frame.x.data()),
+                              frame.box, gpbc, natoms, ePBC, _usePBC,
+                              workerRadius.data(), index, noOccluders,
+                              nullptr, _sasDots,
+                              _useLegacySas ? nullptr : &calculator, atoms);
+          if(adaptive)
+            addWarmupFrame(meanArea, frame.index, atoms, index.size());
+
+          // calculateFrameSas already made the frame whole
+          if(partial)
+          {
+            const unsigned int trajectoryFrame = firstFrame
+                                                 + frame.index * _sasStride;
+            snapshots->reach(contributor, trajectoryFrame,
+                             partial->getState());
+            partial->addFrame(reinterpret_cast<rvec*>(frame.x.data()),
+                              trajectoryFrame);
+          }
+        }
+
+        const unsigned int slot = frame.index % maxInFlight;
+        spareFrames.push(std::move(frame));
+
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending[slot] = atoms;
+        while(pending[nextToWrite % maxInFlight])
+        {
+          SasAtom*& next = pending[nextToWrite % maxInFlight];
+          if(not abortFlag)
+            writeFrame(next);
+          else
+            framePool.release(next);
+          next = nullptr;
+          nextToWrite++;
+        }
+        pendingCondition.notify_all();
+      }
+
+      if(gpbc)
+        gmx_rmpbc_done(gpbc);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(_sasThreads);
+    for(unsigned int i = 0; i < _sasThreads; i++)
+      workers.emplace_back(worker, partials.empty() ? nullptr
+                                                    : partials[i].get(),
+                           i + 1);
+
+    NeighbourhoodSearch neighbourhood(index, candidates, _compactSasCutoff);
+    unsigned int frameIndex = 0;
+    unsigned int trajectoryFrame;
+    do
+    {
+      if(abortFlag)
+        break;
+
+      {
+        std::unique_lock<std::mutex> lock(pendingMutex);
+        while(frameIndex - nextToWrite >= maxInFlight and not abortFlag)
+          pendingCondition.wait(lock);
+      }
+
+      // A spare frame already has room for the coordinates
+      SasFrame frame;
+      spareFrames.tryPop(frame);
+      trajectoryFrame = firstFrame + frameIndex * _sasStride;
+      frame.index = frameIndex++;
+      if(snapshots)
+        snapshots->reach(0, trajectoryFrame, averager->getState());
+      if(_compactSas)
+        neighbourhood.extract(fr.x, ePBC, _usePBC ? fr.box : nullptr, frame);
+      else
+        frame.x.assign(fr.x[0], fr.x[0] + natoms * DIM);
+      copy_mat(fr.box, frame.box);
+      if(not frames.push(std::move(frame)))
+        break;
+
+      // Workers have their own copy, fr.x can be fitted in place
+      if(averager and _compactSas)
+        average(trajectoryFrame);
+    }
+    while(readNextSasX(average, trajectoryFrame));
+
+    frames.close();
+    spareFrames.close();
+    for(std::thread& thread : workers)
+      thread.join();
+
+    if(snapshots)
+    {
+      snapshots->finish(0, averager->getState());
+      for(unsigned int i = 0; i < partials.size(); i++)
+        snapshots->finish(i + 1, partials[i]->getState());
+    }
+
+    for(const std::unique_ptr<StructureAverager>& partial : partials)
+      averager->merge(*partial);
+  }
+
+  void
+  Gromacs::averagePipeline(StructureAverager& averager,
+                           const std::vector<atom_id>& index)
+  {
+    BoundedQueue<SasFrame> frames(_sasThreads * 2);
+    BoundedQueue<SasFrame> spareFrames(_sasThreads * 4);
+    std::vector<std::unique_ptr<StructureAverager>> partials;
+    for(unsigned int i = 0; i < _sasThreads; i++)
+      partials.emplace_back(new StructureAverager(top, xtop, natoms, index));
+
+    // The order of the frames does not matter, partial sums are merged
+    auto worker = [&](StructureAverager* partial)
+    {
+      gmx_rmpbc_t gpbc = initRmpbc(top, ePBC, natoms, fr.box, _usePBC);
+      SasFrame frame;
+      while(frames.pop(frame))
+      {
+        if(abortFlag)
+          continue;
+
+        rvec* x = reinterpret_cast<rvec*>(frame.x.data());
+        if(gpbc)
+          gmx_rmpbc(gpbc, natoms, frame.box, x);
+        partial->addFrame(x, frame.index);
+        spareFrames.push(std::move(frame));
+
+        operationMutex.lock();
+        currentFrame++;
+        wakeCondition.notify_all();
+        operationMutex.unlock();
+      }
+
+      if(gpbc)
+        gmx_rmpbc_done(gpbc);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(_sasThreads);
+    for(unsigned int i = 0; i < _sasThreads; i++)
+      workers.emplace_back(worker, partials[i].get());
+
+    unsigned int frameIndex = 0;
+    do
+    {
+      if(abortFlag)
+        break;
+
+      SasFrame frame;
+      spareFrames.tryPop(frame);
+      frame.index = frameIndex++;
+      frame.x.assign(fr.x[0], fr.x[0] + natoms * DIM);
+      copy_mat(fr.box, frame.box);
+      if(not frames.push(std::move(frame)))
+        break;
+    }
+    while(readNextX());
+
+    frames.close();
+    spareFrames.close();
+    for(std::thread& thread : workers)
+      thread.join();
+
+    for(const std::unique_ptr<StructureAverager>& partial : partials)
+      averager.merge(*partial);
+  }
+
   const Protein<>&
   Gromacs::__calculateAverageStructure()
   {
     std::vector<atom_id> index;
-    int npdbatoms, isize, count;
-    rvec xcm;
-    matrix pdbbox;
-    real *w_rls;
-    real invcount;
-    double *xav, *rmsf;
-    double** U;
-    gmx_rmpbc_t gpbc = nullptr;
     int statusCount = 0;
     averageStructure = Protein<>();
 
@@ -334,87 +1002,50 @@ namespace PstpFinder
     currentFrame = 0;
 
     index = getGroup("Protein");
-    isize = index.size();
-
-    w_rls = new real[top.atoms.nr];
-    for(std::vector<atom_id>::const_iterator i = index.begin(); i < index.end(); i++)
-      w_rls[*i] = top.atoms.atom[*i].m;
-
-    xav = new double[isize * DIM]();
-    U = new double*[isize];
-    for(double** i = U; i < U + isize; i++)
-      *i = new double[DIM * DIM]();
-    rmsf = new double[isize];
-
-    npdbatoms = top.atoms.nr;
-    snew(top.atoms.pdbinfo, npdbatoms);
-    copy_mat(fr.box, pdbbox);
+    StructureAverager averager(top, xtop, natoms, index);
 
-    sub_xcm(xtop, isize, index.data(), top.atoms.atom, xcm, FALSE);
-    if(_usePBC)
-#if GMXVER < 50
-      gpbc = gmx_rmpbc_init(&top.idef, ePBC, natoms, fr.box);
-#else
-      gpbc = gmx_rmpbc_init(&top.idef, ePBC, natoms);
-#endif
-
-    count = 0;
-    do
+    if(_sasThreads > 1)
+      averagePipeline(averager, index);
+    else
     {
-      if(abortFlag)
-        break;
-      if(_usePBC)
-        gmx_rmpbc(gpbc, natoms, fr.box, fr.x);
-      sub_xcm(fr.x, isize, index.data(), top.atoms.atom, xcm, FALSE);
-      do_fit(natoms, w_rls, xtop, fr.x);
-
-      if(abortFlag)
-        break;
-      for(int i = 0; i < isize; i++)
+      gmx_rmpbc_t gpbc = initRmpbc(top, ePBC, natoms, fr.box, _usePBC);
+      do
       {
-        atom_id aid = index[i];
-        for(int d = 0; d < DIM; d++)
-        {
-          xav[i * DIM + d] += fr.x[aid][d];
-          for(int m = 0; m < DIM; m++)
-            U[i][d * DIM + m] += fr.x[aid][d] * fr.x[aid][m];
-        }
+        if(abortFlag)
+          break;
+        if(gpbc)
+          gmx_rmpbc(gpbc, natoms, fr.box, fr.x);
+        averager.addFrame(fr.x, statusCount);
+
+        operationMutex.lock();
+        currentFrame = ++statusCount;
+        wakeCondition.notify_all();
+        operationMutex.unlock();
       }
+      while(readNextX());
 
-      count++;
-      operationMutex.lock();
-      currentFrame = ++statusCount;
-      wakeCondition.notify_all();
-      operationMutex.unlock();
+      if(gpbc)
+        gmx_rmpbc_done(gpbc);
     }
-    while(readNextX());
 
     if(abortFlag)
       return averageStructure;
 
-    if(_usePBC)
-      gmx_rmpbc_done(gpbc);
-    invcount = 1.0 / count;
-    for(int i = 0; i < isize; i++)
-    {
-      for(int d = 0; d < DIM; d++)
-        xav[i * DIM + d] *= invcount;
-
-      for(int d = 0; d < DIM; d++)
-        for(int m = 0; m < DIM; m++)
-          U[i][d * DIM + m] = U[i][d * DIM + m] * invcount
-                              - xav[i * DIM + d] * xav[i * DIM + m];
-    }
+    return buildAverageStructure(averager, index);
+  }
 
-    for(int i = 0; i < isize; i++)
-      rmsf[i] = U[i][XX * DIM + XX] + U[i][YY * DIM + YY] + U[i][ZZ * DIM + ZZ];
+  const Protein<>&
+  Gromacs::buildAverageStructure(const StructureAverager& averager,
+                                 const std::vector<atom_id>& index)
+  {
+    const int isize = index.size();
+    std::vector<double> xav, rmsf;
+    rvec xcm;
 
-    for(double** i = U; i < U + isize; i++)
-      delete[] *i;
-    delete[] U;
+    averageStructure = Protein<>();
+    averager.getResults(xav, rmsf, xcm);
 
-    if(abortFlag)
-      return averageStructure;
+    snew(top.atoms.pdbinfo, top.atoms.nr);
     for(int i = 0; i < isize; i++)
       top.atoms.pdbinfo[index[i]].bfac = 800 * M_PI * M_PI / 3.0 * rmsf[i];
 
@@ -460,18 +1091,9 @@ namespace PstpFinder
         res.chain = 'A';
       }
       res.atoms.push_back(std::move(atom));
-
-      operationMutex.lock();
-      currentFrame = (float) getFramesCount() / isize * i;
-      wakeCondition.notify_all();
-      operationMutex.unlock();
     }
     averageStructure.appendResidue(res);
 
-    delete[] rmsf;
-    delete[] xav;
-    delete[] w_rls;
-
     return averageStructure;
   }
 
@@ -539,13 +1161,15 @@ namespace PstpFinder
         break;
       }
     }
-    // TODO: Return in case of missing target index
-
-    size = grps->index[targetIndex + 1] - grps->index[targetIndex];
-    group.reserve(size);
+    // A missing group (i.e. no "non-Water" in vacuum) is simply empty
+    if(targetIndex >= 0)
+    {
+      size = grps->index[targetIndex + 1] - grps->index[targetIndex];
+      group.reserve(size);
 
-    for(int i = 0; i < size; i++)
-      group.push_back(grps->a[grps->index[targetIndex] + i]);
+      for(int i = 0; i < size; i++)
+        group.push_back(grps->a[grps->index[targetIndex] + i]);
+    }
 
     sfree(gnames);
     sfree(grps->index);
@@ -605,14 +1229,42 @@ namespace PstpFinder
 #endif
     }
     else
+    {
+      prefetcher.reset();
+      trajectoryReader.reset();
+      mappedTrajectory.reset();
       close_trx(status);
+    }
 
     cachedNFrames = 0;
     timeStepCached = 0;
     currentFrame = 0;
 
-    if(not read_first_frame(oenv, &status, trjName.c_str(), &fr,
-                                  TRX_NEED_X))
+    /*
+     * With an index, GROMACS doesn't need to decode every frame before the
+     * beginning: the first frame is read ignoring it and then the file is
+     * moved straight to the right frame.
+     */
+    const FrameIndex& index = getFrameIndex();
+    const std::size_t beginFrame = _begin != -1 ? index.find(_begin) : 0;
+    const bool seekBegin = index.isSeekable() and beginFrame > 0
+                           and beginFrame < index.size();
+    if(seekBegin)
+      setTimeValue(gmx_legacy::TBEGIN, -std::numeric_limits<real>::max());
+
+    bool gotFirstFrame = read_first_frame(oenv, &status, trjName.c_str(), &fr,
+                                          TRX_NEED_X);
+    if(seekBegin)
+    {
+      if(gotFirstFrame)
+      {
+        gmx_fio_seek(trx_get_fileio(status), index[beginFrame].offset);
+        gotFirstFrame = read_next_frame(oenv, status, &fr);
+      }
+      setTimeValue(gmx_legacy::TBEGIN, _begin);
+    }
+
+    if(not gotFirstFrame)
 #elif GMXVER < 45
     if((natoms =
             read_first_x(&status, trjName.c_str(), &t, &x, box)) == 0)
@@ -626,6 +1278,26 @@ namespace PstpFinder
     {
 #if GMXVER >= 45
       natoms = fr.natoms;
+
+      // The first frame is already read, the others can come from K handles
+      if(_decodeThreads > 1 and ParallelTrajectoryReader::isSupported(trjName))
+        startTrajectoryReader(fr.time);
+
+      nextTrajectoryFrame = (seekBegin ? beginFrame : index.find(fr.time))
+                            + 1;
+
+      // The following frames are decoded from the mapped file
+      if(not trajectoryReader and _mapTrajectory and index.isSeekable()
+         and nextTrajectoryFrame < index.size()
+         and MappedTrajectory::canDecode(trjName))
+      {
+        mappedTrajectory.reset(new MappedTrajectory(trjName));
+        if(not mappedTrajectory->isOpen() or not mappedTrajectory->seek(
+            index[nextTrajectoryFrame].offset))
+          mappedTrajectory.reset();
+      }
+
+      startPrefetcher(1);
 #endif
       readyToGetX = true;
       return gotTrajectory = true;
@@ -654,65 +1326,229 @@ namespace PstpFinder
         throw;
 
 #if GMXVER >= 45
-    out = read_next_frame(oenv, status, &fr);
+    // Frames read ahead with a stride skip the ones wanted here
+    if(prefetcher and prefetchStride > 1 and not seekFrame(nextTrajectoryFrame))
+    {
+      readyToGetX = false;
+      return false;
+    }
+
+    if(prefetcher)
+      out = prefetcher->next(fr);
+    else
+      out = readTrajectoryFrame(fr);
 #elif GMXVER < 45
     out = read_next_x(status, &t, natoms, x, box);
 #endif
 
     if(not out)
       readyToGetX = false;
+    else
+      nextTrajectoryFrame++;
 
     return out;
   }
 
-  unsigned int
-  Gromacs::getFramesCount() const
+#if GMXVER >= 45
+  bool
+  Gromacs::readTrajectoryFrame(t_trxframe& frame)
   {
-    if(cachedNFrames > 0)
-      return cachedNFrames;
-    else if(_begin != -1 and _end != -1)
+    bool out;
+
+    if(trajectoryReader)
+      out = trajectoryReader->next(frame);
+    else if(mappedTrajectory)
     {
-      cachedNFrames = (_end - _begin) / getTimeStep();
-      return cachedNFrames;
+      // Time control of GROMACS is not applied to mapped frames
+      do
+        out = mappedTrajectory->next(frame);
+      while(out and _begin != -1 and frame.time < _begin);
+      if(out and _end != -1 and frame.time > _end)
+        out = false;
     }
+    else
+      out = read_next_frame(oenv, status, &frame);
 
-    if(not exists(trjName))
-      return 0;
+    return out;
+  }
 
-    int nFrames = 0;
-    std::string extension = file_extension(trjName);
-    transform(std::begin(extension), std::end(extension), std::begin(extension), ::tolower);
-    if(extension == "pdb")
+  void
+  Gromacs::startTrajectoryReader(real firstTime)
+  {
+    float lastTime = getLastFrameTime();
+    if(_end != -1 and _end < lastTime)
+      lastTime = _end;
+
+    trajectoryReader.reset(new ParallelTrajectoryReader(
+        trjName, natoms, firstTime, lastTime, getTimeStep(), _decodeThreads,
+        &getFrameIndex()));
+  }
+
+  void
+  Gromacs::startPrefetcher(unsigned int stride)
+  {
+    prefetcher.reset();
+    prefetchStride = stride;
+
+    // Parallel decoding already works ahead of the reader
+    if(_prefetchFrames == 0 or trajectoryReader)
+      return;
+
+    if(stride <= 1)
     {
-      /* I use old std legacy method for pdb files */
-      output_env_t _oenv;
-      t_trxstatus *_status;
-      t_trxframe _fr;
+      prefetcher.reset(new FramePrefetcher(fr, _prefetchFrames,
+                                           [this](t_trxframe& frame)
+                                           {
+                                             return readTrajectoryFrame(frame);
+                                           }));
+      return;
+    }
 
-#if GMXVER < 50 
-      snew(_oenv, 1);
-      output_env_init_default(_oenv);
-#else
-      output_env_init_default(&_oenv);
+    // Only the frames that will be used are read ahead, seeking over the others
+    const FrameIndex& index = getFrameIndex();
+    unsigned int frameToRead = nextTrajectoryFrame;
+    prefetcher.reset(new FramePrefetcher(
+        fr, _prefetchFrames,
+        [this, &index, stride, frameToRead](t_trxframe& frame) mutable
+        {
+          if(frameToRead >= index.size() or not seekTrajectory(frameToRead)
+             or not readTrajectoryFrame(frame))
+            return false;
+
+          // Time control could have skipped frames before the beginning
+          frameToRead = index.find(frame.time) + stride;
+          return true;
+        }));
+  }
+
+  bool
+  Gromacs::seekTrajectory(unsigned int frame)
+  {
+    const FrameIndex& index = getFrameIndex();
+    if(mappedTrajectory)
+      return mappedTrajectory->seek(index[frame].offset);
+    else
+      return gmx_fio_seek(trx_get_fileio(status), index[frame].offset) == 0;
+  }
 #endif
 
-      if(not read_first_frame(_oenv, &_status, trjName.c_str(), &_fr, 0))
+  bool
+  Gromacs::readNextX(unsigned int stride)
+  {
+    if(stride <= 1)
+      return readNextX();
+
+#if GMXVER >= 45
+    // Parallel decoding reads every frame anyway, they are simply skipped
+    if(gotTrajectory and readyToGetX and getFrameIndex().isSeekable()
+       and not trajectoryReader)
+    {
+      // Frames in between are never decoded
+      if(prefetcher and prefetchStride == stride)
       {
-        output_env_done(_oenv);
-        return 0;
-      }  
-      nFrames = 1;
+        if(prefetcher->next(fr))
+        {
+          nextTrajectoryFrame = getFrameIndex().find(fr.time) + 1;
+          return true;
+        }
+      }
+      else if(readFrame(nextTrajectoryFrame - 1 + stride, stride))
+        return true;
+
+      readyToGetX = false;
+      return false;
+    }
+#endif
 
-      while(read_next_frame(_oenv, _status, &_fr))
-        nFrames++;
+    for(unsigned int i = 0; i < stride; i++)
+      if(not readNextX())
+        return false;
 
-      close_trx(_status);
-      output_env_done(_oenv);
+    return true;
+  }
+
+  bool
+  Gromacs::readNextSasX(const std::function<void(unsigned int)>& average,
+                        unsigned int trajectoryFrame)
+  {
+    // The average structure is taken over every frame, SAS every stride
+    if(not average or _sasStride <= 1)
+      return readNextX(_sasStride);
+
+    for(unsigned int i = 1; i < _sasStride; i++)
+    {
+      if(not readNextX())
+        return false;
+      average(trajectoryFrame + i);
     }
-    else
-    	nFrames = getLastFrameTime() / getTimeStep() + 1;
 
-    return cachedNFrames = nFrames;
+    return readNextX();
+  }
+
+  bool
+  Gromacs::seekFrame(unsigned int frame, unsigned int stride)
+  {
+#if GMXVER >= 45
+    if(not gotTrajectory and not getTrajectory())
+      return false;
+
+    const FrameIndex& index = getFrameIndex();
+    if(not index.isSeekable() or frame >= index.size())
+      return false;
+
+    // Frames read ahead follow the old position, they are useless now
+    prefetcher.reset();
+    if(trajectoryReader)
+    {
+      // Decoding handles seek by themselves to the frames after firstTime
+      trajectoryReader.reset();
+      startTrajectoryReader(index[frame].time - getTimeStep());
+    }
+    else if(not seekTrajectory(frame))
+      return false;
+
+    nextTrajectoryFrame = frame;
+    startPrefetcher(stride);
+    readyToGetX = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool
+  Gromacs::readFrame(unsigned int frame, unsigned int stride)
+  {
+#if GMXVER >= 45
+    if(not seekFrame(frame, stride))
+      return false;
+
+    if(not (prefetcher ? prefetcher->next(fr) : readTrajectoryFrame(fr)))
+    {
+      readyToGetX = false;
+      return false;
+    }
+
+    // Time control could have skipped frames before the beginning
+    nextTrajectoryFrame = getFrameIndex().find(fr.time) + 1;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  unsigned int
+  Gromacs::getFramesCount() const
+  {
+    if(cachedNFrames > 0)
+      return cachedNFrames;
+    else if(_begin != -1 and _end != -1)
+    {
+      cachedNFrames = (_end - _begin) / getTimeStep();
+      return cachedNFrames;
+    }
+
+    return cachedNFrames = getFrameIndex().size();
   }
 
   unsigned int
@@ -750,108 +1586,45 @@ namespace PstpFinder
   float
   Gromacs::getLastFrameTime() const
   {
-    if(not exists(trjName))
-      return 0;
-
-    output_env_t _oenv;
-    t_trxstatus *_status;
-    t_trxframe _fr;
-    t_fileio *fio;
-    gmx_bool ok;
-
-#if GMXVER < 50
-    snew(_oenv, 1);
-    output_env_init_default(_oenv);
-#else
-    output_env_init_default(&_oenv);
-#endif
-
-    if(not read_first_frame(_oenv, &_status, trjName.c_str(), &_fr, 0))
-    {
-      output_env_done(_oenv);
-      return 0;
-    }
-
-    fio = trx_get_fileio(_status);
-    float lastTime = gmx_legacy::xdr_xtc_get_last_frame_time(gmx_fio_getfp(fio),
-            gmx_legacy::gmx_fio_getxdr(fio), _fr.natoms, &ok);
-
-    close_trx(_status);
-    output_env_done(_oenv);
-    if(not ok)
-      throw "ERROR: can not get the last frame time";
-
-    return lastTime;
+    const FrameIndex& index = getFrameIndex();
+    return index.empty() ? 0 : index.back().time;
   }
 
   float
   Gromacs::getTimeStep() const
   {
-    if(not exists(trjName))
-      return 0;
-
     if(timeStepCached != 0)
       return timeStepCached;
 
-    output_env_t _oenv;
-    t_trxstatus *_status;
-    t_trxframe _fr;
-    float time1, time2;
-
-#if GMXVER < 50
-    snew(_oenv, 1);
-    output_env_init_default(_oenv);
-#else
-    output_env_init_default(&_oenv);
-#endif
-
-    if(not read_first_frame(_oenv, &_status, trjName.c_str(), &_fr, 0))
-    {
-      output_env_done(_oenv);
+    const FrameIndex& index = getFrameIndex();
+    if(index.size() < 2)
       return 0;
-    }
-
-    time1 = _fr.time;
-    read_next_frame(_oenv, _status, &_fr);
-    time2 = _fr.time;
-    close_trx(_status);
 
-    output_env_done(_oenv);
-
-    timeStepCached = time2 - time1;
+    timeStepCached = index[1].time - index[0].time;
     return timeStepCached;
   }
 
   unsigned int
   Gromacs::getFrameStep() const
   {
-    if(exists(trjName))
+    const FrameIndex& index = getFrameIndex();
+    if(index.size() < 2)
       return 0;
 
-    output_env_t _oenv;
-    t_trxstatus *_status;
-    t_trxframe _fr;
-
-#if GMXVER < 50
-    snew(_oenv, 1);
-    output_env_init_default(_oenv);
-#else
-    output_env_init_default(&_oenv);
-#endif
+    return index[1].step - index[0].step;
+  }
 
-    if(read_first_frame(_oenv, &_status, trjName.c_str(), &_fr, 0))
+  const FrameIndex&
+  Gromacs::getFrameIndex() const
+  {
+    std::lock_guard<std::mutex> lock(frameIndexMutex);
+    if(not frameIndexLoaded)
     {
-      close_trx(_status);
-      output_env_done(_oenv);
-      return 0;
+      frameIndex.load(trjName);
+      frameIndexLoaded = true;
     }
 
-    read_next_frame(_oenv, _status, &_fr);
-    close_trx(_status);
-
-    output_env_done(_oenv);
-
-    return _fr.step;
+    return frameIndex;
   }
 
   float
@@ -907,9 +1680,153 @@ namespace PstpFinder
     return _usePBC = value;
   }
 
-  template void Gromacs::__calculateSas(Session<std::fstream>&);
-  template void Gromacs::__calculateSas(Session<std::ofstream>&);
+  unsigned int
+  Gromacs::sasThreads() const noexcept
+  {
+    return _sasThreads;
+  }
+
+  unsigned int
+  Gromacs::sasThreads(unsigned int value) noexcept
+  {
+    return _sasThreads = value > 0 ? value : 1;
+  }
+
+  bool
+  Gromacs::useLegacySas() const noexcept
+  {
+    return _useLegacySas;
+  }
+
+  bool
+  Gromacs::useLegacySas(bool value) noexcept
+  {
+    return _useLegacySas = value;
+  }
+
+  bool
+  Gromacs::incrementalSas() const noexcept
+  {
+    return _incrementalSas;
+  }
+
+  bool
+  Gromacs::incrementalSas(bool value) noexcept
+  {
+    return _incrementalSas = value;
+  }
+
+  unsigned int
+  Gromacs::sasDots() const noexcept
+  {
+    return _sasDots;
+  }
+
+  unsigned int
+  Gromacs::sasDots(unsigned int value) noexcept
+  {
+    return _sasDots = value > 0 ? value : 1;
+  }
+
+  bool
+  Gromacs::adaptiveSas() const noexcept
+  {
+    return _adaptiveSas;
+  }
+
+  bool
+  Gromacs::adaptiveSas(bool value) noexcept
+  {
+    return _adaptiveSas = value;
+  }
+
+  bool
+  Gromacs::compactSas() const noexcept
+  {
+    return _compactSas;
+  }
+
+  bool
+  Gromacs::compactSas(bool value) noexcept
+  {
+    return _compactSas = value;
+  }
+
+  unsigned int
+  Gromacs::decodeThreads() const noexcept
+  {
+    return _decodeThreads;
+  }
+
+  unsigned int
+  Gromacs::decodeThreads(unsigned int value) noexcept
+  {
+    return _decodeThreads = value > 0 ? value : 1;
+  }
+
+  bool
+  Gromacs::mapTrajectory() const noexcept
+  {
+    return _mapTrajectory;
+  }
+
+  bool
+  Gromacs::mapTrajectory(bool value) noexcept
+  {
+    return _mapTrajectory = value;
+  }
+
+  unsigned int
+  Gromacs::prefetchFrames() const noexcept
+  {
+    return _prefetchFrames;
+  }
+
+  unsigned int
+  Gromacs::prefetchFrames(unsigned int value) noexcept
+  {
+    return _prefetchFrames = value;
+  }
+
+  unsigned int
+  Gromacs::sasStride() const noexcept
+  {
+    return _sasStride;
+  }
+
+  unsigned int
+  Gromacs::sasStride(unsigned int value) noexcept
+  {
+    return _sasStride = value > 0 ? value : 1;
+  }
+
+  float
+  Gromacs::compactSasCutoff() const noexcept
+  {
+    return _compactSasCutoff;
+  }
+
+  float
+  Gromacs::compactSasCutoff(float value) noexcept
+  {
+    return _compactSasCutoff = value > 0 ? value : 0;
+  }
+
+  template void Gromacs::__calculateSas(Session<std::fstream>&,
+                                       StructureAverager*);
+  template void Gromacs::__calculateSas(Session<std::ofstream>&,
+                                       StructureAverager*);
 
   template void Gromacs::calculateSas(Session<std::fstream>&);
   template void Gromacs::calculateSas(Session<std::ofstream>&);
+
+  template void Gromacs::__calculateSasAndAverageStructure(
+      Session<std::fstream>&);
+  template void Gromacs::__calculateSasAndAverageStructure(
+      Session<std::ofstream>&);
+
+  template void Gromacs::calculateSasAndAverageStructure(
+      Session<std::fstream>&);
+  template void Gromacs::calculateSasAndAverageStructure(
+      Session<std::ofstream>&);
 }
@@ -28,11 +28,17 @@
 #endif
 
 #include "Pdb.h"
+#include "SasAtom.h"
+#include "FrameIndex.h"
+#include "FramePool.h"
 
 #include <string>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
+#include <memory>
 
 #if GMXVER <= 45
 /* Workaround - is not defined as "C", let's include it before others */
@@ -85,58 +91,6 @@ struct gmx_residuetype
     char **  restype;
 };
 
-#if GMXVER == 50
-
-/* Taken from src/gromacs/fileio/gmx_system_xdr.h, Gromacs 5.0.1 */
-typedef int bool_t;
-typedef int xdr_int32_t;
-typedef unsigned int xdr_uint32_t;
-
-enum xdr_op {
-    XDR_ENCODE = 0,
-    XDR_DECODE = 1,
-    XDR_FREE   = 2
-};
-
-struct XDR
-{
-    enum xdr_op x_op;       /* operation; fast additional param */
-    struct xdr_ops
-    {
-        bool_t       (*x_getbytes) (XDR *__xdrs, char *__addr, unsigned int __len);
-        /* get some bytes from " */
-        bool_t       (*x_putbytes) (XDR *__xdrs, char *__addr, unsigned int __len);
-        /* put some bytes to " */
-        unsigned int (*x_getpostn) (XDR *__xdrs);
-        /* returns bytes off from beginning */
-        bool_t       (*x_setpostn) (XDR *__xdrs, unsigned int __pos);
-        /* lets you reposition the stream */
-        xdr_int32_t *(*x_inline) (XDR *__xdrs, int __len);
-        /* buf quick ptr to buffered data */
-        void         (*x_destroy) (XDR *__xdrs);
-        /* free privates of this xdr_stream */
-        bool_t       (*x_getint32) (XDR *__xdrs, xdr_int32_t *__ip);
-        /* get a int from underlying stream */
-        bool_t       (*x_putint32) (XDR *__xdrs, xdr_int32_t *__ip);
-        /* put a int to " */
-        bool_t       (*x_getuint32) (XDR *__xdrs, xdr_uint32_t *__ip);
-        /* get a unsigned int from underlying stream */
-        bool_t       (*x_putuint32) (XDR *__xdrs, xdr_uint32_t *__ip);
-        /* put a int to " */
-    }
-    *x_ops;
-    char *x_public;     /* users' data */
-    char *x_private;    /* pointer to private data */
-    char *x_base;       /* private used for position info */
-    int   x_handy;      /* extra private word */
-};
-
-#endif /* GMXVER == 50 */
-
-/* Taken from src/gromacs/fileio/xdrf.h, Gromacs 5.0.1 */
-extern "C" float xdr_xtc_get_last_frame_time(FILE *fp, XDR *xdrs, int natoms, gmx_bool * bOK);
-extern "C" XDR *gmx_fio_getxdr(struct t_fileio *fio);
-
 /* Taken from src/gromacs/fileio/timecontrol.h, Gromacs 5.0.1 */
 enum {
     TBEGIN, TEND, TDELTA, TNR
@@ -148,6 +102,12 @@ extern "C" void setTimeValue(int tcontrol, real value);
 
 namespace PstpFinder
 {
+  class StructureAverager;
+  class AverageSnapshots;
+  class ParallelTrajectoryReader;
+  class MappedTrajectory;
+  class FramePrefetcher;
+
   class Gromacs
   {
     public:
@@ -161,11 +121,18 @@ namespace PstpFinder
       // FIXME: additional informations
       template<typename Stream>
       void calculateSas(Session<Stream>& session);
+
+      /**
+       * @brief Calculates SAS and average structure in a single pass
+       */
+      template<typename Stream>
+      void calculateSasAndAverageStructure(Session<Stream>& session);
     
       std::string getTrajectoryFile() const;
       std::string getTopologyFile() const;
       unsigned long getAtomsCount() const;
       unsigned int getFramesCount() const;
+      // Backed by a FrameIndex, the trajectory is scanned only once
       float getTimeStep() const; // In nsec
       float getLastFrameTime() const;
       unsigned int getFrameStep() const;
@@ -191,7 +158,10 @@ namespace PstpFinder
       void waitNextFrame(unsigned int refFrame) const;
 
       template<typename Stream>
-      void __calculateSas(Session<Stream>& session);
+      void __calculateSas(Session<Stream>& session,
+                          StructureAverager* averager = nullptr);
+      template<typename Stream>
+      void __calculateSasAndAverageStructure(Session<Stream>& session);
       const Protein<>& __calculateAverageStructure();
       void calculateAverageStructure();
       const Protein<>& getAverageStructure() const;
@@ -202,6 +172,88 @@ namespace PstpFinder
       bool usePBC() const noexcept;
       bool usePBC(bool value) noexcept;
 
+      /**
+       * @brief Number of worker threads used to calculate SAS
+       *
+       * When more than one thread is used, a reader thread decodes frames
+       * into a bounded queue and the workers calculate SAS on their own copy
+       * of the frame. Results are written back in frame order.
+       */
+      unsigned int sasThreads() const noexcept;
+      unsigned int sasThreads(unsigned int value) noexcept;
+
+      /**
+       * @brief Use GROMACS nsc_dclm_pbc (serialized) instead of SasCalculator
+       */
+      bool useLegacySas() const noexcept;
+      bool useLegacySas(bool value) noexcept;
+
+      /**
+       * @brief Reuse neighbour lists and areas between frames (SasCalculator)
+       */
+      bool incrementalSas() const noexcept;
+      bool incrementalSas(bool value) noexcept;
+
+      /**
+       * @brief Dots per atom, only near the mean SAS when adaptive
+       */
+      unsigned int sasDots() const noexcept;
+      unsigned int sasDots(unsigned int value) noexcept;
+      bool adaptiveSas() const noexcept;
+      bool adaptiveSas(bool value) noexcept;
+
+      /**
+       * @brief Use only the protein and the non-water atoms within cutoff nm
+       */
+      bool compactSas() const noexcept;
+      bool compactSas(bool value) noexcept;
+      float compactSasCutoff() const noexcept;
+      float compactSasCutoff(float value) noexcept;
+
+      /**
+       * @brief Handles decoding XTC frames in parallel (ParallelTrajectoryReader)
+       */
+      unsigned int decodeThreads() const noexcept;
+      unsigned int decodeThreads(unsigned int value) noexcept;
+
+      /**
+       * @brief Decode XTC and TRR frames from a memory mapped file
+       */
+      bool mapTrajectory() const noexcept;
+      bool mapTrajectory(bool value) noexcept;
+
+      /**
+       * @brief Number of frames read ahead on a separate thread, 0 for none
+       */
+      unsigned int prefetchFrames() const noexcept;
+      unsigned int prefetchFrames(unsigned int value) noexcept;
+
+      /**
+       * @brief Calculate SAS only every stride frames
+       *
+       * The average structure still takes every frame.
+       */
+      unsigned int sasStride() const noexcept;
+      unsigned int sasStride(unsigned int value) noexcept;
+
+      /**
+       * @brief Moves the trajectory so that the next frame read is frame
+       *
+       * Frames are numbered from the beginning of the file.
+       * @return false if the trajectory has no seekable FrameIndex
+       */
+      bool seekFrame(unsigned int frame, unsigned int stride = 1);
+
+      /**
+       * @brief Reads frame (see seekFrame()) in place of the current one
+       */
+      bool readFrame(unsigned int frame, unsigned int stride = 1);
+
+      /**
+       * @brief Reads the frame stride frames after the current one
+       */
+      bool readNextX(unsigned int stride);
+
     private:
 #if GMXVER >= 45
       output_env_t oenv;
@@ -224,6 +276,27 @@ namespace PstpFinder
       bool gotTrajectory, gotTopology, readyToGetX;
       float solSize;
       std::string sasTarget;
+      unsigned int _sasThreads;
+      bool _useLegacySas;
+      bool _incrementalSas;
+      unsigned int _sasDots;
+      bool _adaptiveSas;
+      bool _compactSas;
+      float _compactSasCutoff;
+      unsigned int _decodeThreads;
+      bool _mapTrajectory;
+      unsigned int _prefetchFrames;
+      unsigned int _sasStride;
+      // Frame of the file returned by the next read
+      unsigned int nextTrajectoryFrame;
+      // Frames between the ones read ahead by prefetcher
+      unsigned int prefetchStride;
+      mutable FrameIndex frameIndex;
+      mutable bool frameIndexLoaded;
+      mutable std::mutex frameIndexMutex;
+      std::unique_ptr<ParallelTrajectoryReader> trajectoryReader;
+      std::unique_ptr<MappedTrajectory> mappedTrajectory;
+      std::unique_ptr<FramePrefetcher> prefetcher;
     
       std::thread operationThread;
       mutable std::mutex operationMutex;
@@ -239,6 +312,32 @@ namespace PstpFinder
       bool getTopology();
       bool getTrajectory();
       bool readNextX();
+
+      /**
+       * @brief Reads the next frame for SAS, averaging the ones skipped
+       * @param trajectoryFrame Position of the current frame
+       */
+      bool readNextSasX(const std::function<void(unsigned int)>& average,
+                        unsigned int trajectoryFrame);
+#if GMXVER >= 45
+      bool readTrajectoryFrame(t_trxframe& frame);
+      void startTrajectoryReader(real firstTime);
+      void startPrefetcher(unsigned int stride);
+      bool seekTrajectory(unsigned int frame);
+#endif
+      const FrameIndex& getFrameIndex() const;
+      void sasPipeline(const real* radius, std::vector<atom_id>& index,
+                       const std::vector<atom_id>& candidates,
+                       StructureAverager* averager,
+                       const std::function<void(unsigned int)>& average,
+                       AverageSnapshots* snapshots,
+                       FramePool<SasAtom>& framePool,
+                       const std::function<void(SasAtom*)>& writeFrame);
+      void averagePipeline(StructureAverager& averager,
+                           const std::vector<atom_id>& index);
+      const Protein<>& buildAverageStructure(
+          const StructureAverager& averager,
+          const std::vector<atom_id>& index);
   };
 }
 #endif
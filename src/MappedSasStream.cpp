@@ -0,0 +1,269 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MappedSasStream.h"
+#include "Session.h"
+
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace PstpFinder
+{
+  MappedSasStream::MappedSasStream(const std::string& sessionFileName,
+                                   unsigned int nAtoms) :
+      nAtoms(nAtoms), compact(false), aligned(false), fd(-1), data(nullptr),
+      length(0), sasBegin(0), sasEnd(0), position(0), damaged(false),
+      chunkData(nullptr),
+      chunkStride(1), chunkFrames(0), currentFrame(0)
+  {
+#ifndef PSTPFINDER_BIG_ENDIAN
+    {
+      Session<std::ifstream> session(sessionFileName);
+      if(not session.sasComplete())
+        return;
+
+      compact = session.isSasCompact();
+      aligned = session.isSasAligned();
+      if(compact)
+        codec = SasCodec(nAtoms, session.getSasPrecision());
+      sasBegin = session.getSasOffset();
+      sasEnd = sasBegin + session.getSasSize();
+    }
+
+    struct stat info;
+    fd = open(sessionFileName.c_str(), O_RDONLY);
+    if(fd == -1)
+      return;
+
+    if(fstat(fd, &info) != 0 or info.st_size < sasEnd or sasEnd == 0)
+    {
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    data = static_cast<const unsigned char*>(mapping);
+    length = info.st_size;
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    rewind();
+#endif
+  }
+
+  MappedSasStream::~MappedSasStream()
+  {
+    if(data)
+      munmap(const_cast<unsigned char*>(data), length);
+    if(fd != -1)
+      close(fd);
+  }
+
+  bool
+  MappedSasStream::isOpen() const
+  {
+    return data != nullptr;
+  }
+
+  unsigned int
+  MappedSasStream::getAtomsCount() const
+  {
+    return nAtoms;
+  }
+
+  void
+  MappedSasStream::rewind()
+  {
+    position = sasBegin;
+    damaged = false;
+    chunkData = nullptr;
+    chunkFrames = 0;
+    currentFrame = 0;
+  }
+
+  bool
+  MappedSasStream::next(SasSpan& frame)
+  {
+    if(not data)
+      return false;
+
+    while(currentFrame == chunkFrames)
+    {
+      if(not loadChunk())
+        return false;
+    }
+
+    frame.data = chunkData + currentFrame * chunkStride * nAtoms;
+    frame.stride = chunkStride;
+    currentFrame++;
+
+    return true;
+  }
+
+  bool
+  MappedSasStream::isDamaged() const
+  {
+    return damaged;
+  }
+
+  bool
+  MappedSasStream::readUint(unsigned int& value)
+  {
+    // Written by Serializer, little endian like the host
+    if(position + static_cast<std::int64_t>(sizeof(unsigned int)) > sasEnd)
+      return false;
+
+    std::memcpy(&value, data + position, sizeof(unsigned int));
+    position += sizeof(unsigned int);
+    return true;
+  }
+
+  std::int64_t
+  MappedSasStream::chunkPadding() const
+  {
+    // Same padding as SasAnalysis, relative to the stream
+    if(not aligned)
+      return 0;
+
+    return (sizeof(real) - (position - sasBegin) % sizeof(real))
+           % sizeof(real);
+  }
+
+  unsigned long
+  MappedSasStream::countFrames()
+  {
+    unsigned long frames = 0;
+    unsigned int chunkSize;
+    bool whole = true;
+
+    rewind();
+    while(data and position < sasEnd)
+    {
+      if(not readUint(chunkSize))
+      {
+        whole = false;
+        break;
+      }
+
+      std::int64_t bytes;
+      if(codec.getPrecision() > 0)
+      {
+        unsigned int encodedBytes;
+        if(not readUint(encodedBytes))
+        {
+          whole = false;
+          break;
+        }
+        bytes = encodedBytes;
+      }
+      else
+      {
+        position += chunkPadding();
+        bytes = static_cast<std::int64_t>(chunkSize) * nAtoms
+                * (compact ? 1 : 4) * sizeof(real);
+      }
+
+      if(position + bytes > sasEnd)
+      {
+        whole = false;
+        break;
+      }
+      position += bytes;
+      frames += chunkSize;
+    }
+
+    rewind();
+    damaged = not whole;
+    return frames;
+  }
+
+  bool
+  MappedSasStream::loadChunk()
+  {
+    unsigned int frames;
+    if(position == sasEnd)
+      return false;
+
+    // Whatever stops the stream from now on is a damaged chunk
+    damaged = true;
+    if(not readUint(frames))
+      return false;
+
+    if(codec.getPrecision() > 0)
+    {
+      unsigned int encodedBytes;
+      if(not readUint(encodedBytes) or position + encodedBytes > sasEnd)
+        return false;
+
+      chunkBuffer.resize(static_cast<std::size_t>(frames) * nAtoms);
+      if(not codec.decode(data + position, encodedBytes, chunkBuffer.data(),
+                          frames))
+        return false;
+
+      position += encodedBytes;
+      chunkData = chunkBuffer.data();
+      chunkStride = 1;
+    }
+    else
+    {
+      position += chunkPadding();
+      chunkStride = compact ? 1 : 4;
+      const std::size_t values = static_cast<std::size_t>(frames) * nAtoms
+                                 * chunkStride;
+      const std::int64_t bytes = values * sizeof(real);
+      if(position + bytes > sasEnd)
+        return false;
+
+      madvise(const_cast<unsigned char*>(data) + position / getpagesize()
+              * getpagesize(), bytes + position % getpagesize(),
+              MADV_WILLNEED);
+
+      const unsigned char* chunk = data + position;
+      if(reinterpret_cast<std::uintptr_t>(chunk) % alignof(real) == 0)
+        chunkData = reinterpret_cast<const real*>(chunk);
+      else
+      {
+        // Sessions before version 3 are not aligned
+        chunkBuffer.resize(values);
+        std::memcpy(chunkBuffer.data(), chunk, bytes);
+        chunkData = chunkBuffer.data();
+      }
+
+      // SasAtom stores x, y and z before sas
+      if(not compact)
+        chunkData += 3;
+      position += bytes;
+    }
+
+    chunkFrames = frames;
+    currentFrame = 0;
+    damaged = false;
+    return true;
+  }
+}
@@ -0,0 +1,115 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MAPPEDSASSTREAM_H
+#define _MAPPEDSASSTREAM_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SasCodec.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Read-only view of the SAS of a frame, values stride reals apart
+   */
+  struct SasSpan
+  {
+    const real* data;
+    std::size_t stride;
+
+    real
+    operator [](std::size_t atom) const
+    {
+      return data[atom * stride];
+    }
+  };
+
+  /**
+   * @brief Reads the SAS stream of a complete session from a mapping
+   *
+   * Uncompressed chunks of aligned sessions are viewed in place. Never open
+   * on big-endian hosts, where SasAnalysis has to be used.
+   */
+  class MappedSasStream
+  {
+    public:
+      MappedSasStream(const std::string& sessionFileName,
+                      unsigned int nAtoms);
+      ~MappedSasStream();
+      MappedSasStream(const MappedSasStream&) = delete;
+      MappedSasStream& operator =(const MappedSasStream&) = delete;
+
+      bool isOpen() const;
+      unsigned int getAtomsCount() const;
+
+      /**
+       * @brief Views the next frame, valid until another chunk is read
+       * @return false at the end of the stream or on a truncated chunk
+       */
+      bool next(SasSpan& frame);
+
+      /**
+       * @brief Whether next() or countFrames() stopped on a damaged chunk
+       */
+      bool isDamaged() const;
+
+      /**
+       * @brief Moves back to the first frame
+       */
+      void rewind();
+
+      /**
+       * @brief Frames in complete chunks, then rewinds
+       */
+      unsigned long countFrames();
+
+    private:
+      unsigned int nAtoms;
+      bool compact;
+      bool aligned;
+      SasCodec codec;
+      int fd;
+      const unsigned char* data;
+      std::int64_t length;
+      std::int64_t sasBegin;
+      std::int64_t sasEnd;
+      std::int64_t position;
+      bool damaged;
+
+      const real* chunkData;
+      std::size_t chunkStride;
+      unsigned int chunkFrames;
+      unsigned int currentFrame;
+      std::vector<real> chunkBuffer;
+
+      bool loadChunk();
+      bool readUint(unsigned int& value);
+      std::int64_t chunkPadding() const;
+  };
+}
+
+#endif /* _MAPPEDSASSTREAM_H */
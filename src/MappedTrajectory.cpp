@@ -0,0 +1,399 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MappedTrajectory.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/gmxfio.h>
+}
+
+#include <gromacs/xtcio.h>
+#else
+#include <gromacs/fileio/gmxfio.h>
+#include <gromacs/fileio/xtcio.h>
+#endif
+
+namespace PstpFinder
+{
+  static constexpr std::int32_t xtcMagic = 1995;
+  static constexpr std::int32_t trrMagic = 1993;
+  // Bytes requested ahead of the current frame
+  static constexpr std::int64_t prefetchWindow = 16l << 20;
+
+  // XDR is big endian
+  static inline std::uint32_t
+  xdrUint(const unsigned char* bytes)
+  {
+    return static_cast<std::uint32_t>(bytes[0]) << 24
+           | static_cast<std::uint32_t>(bytes[1]) << 16
+           | static_cast<std::uint32_t>(bytes[2]) << 8 | bytes[3];
+  }
+
+  static inline float
+  xdrFloat(const unsigned char* bytes)
+  {
+    const std::uint32_t value = xdrUint(bytes);
+    float out;
+    std::memcpy(&out, &value, sizeof(float));
+    return out;
+  }
+
+  static inline double
+  xdrDouble(const unsigned char* bytes)
+  {
+    const std::uint64_t value = static_cast<std::uint64_t>(xdrUint(bytes)) << 32
+                                | xdrUint(bytes + 4);
+    double out;
+    std::memcpy(&out, &value, sizeof(double));
+    return out;
+  }
+
+  static inline real
+  xdrReal(const unsigned char* bytes, unsigned int realSize)
+  {
+    return realSize == sizeof(float) ? xdrFloat(bytes) : xdrDouble(bytes);
+  }
+
+  static std::string
+  lowerExtension(const std::string& fileName)
+  {
+    std::string extension = file_extension(fileName);
+    std::transform(std::begin(extension), std::end(extension),
+                   std::begin(extension), ::tolower);
+    return extension;
+  }
+
+  MappedTrajectory::MappedTrajectory(const std::string& fileName) :
+      fileName(fileName),
+      format(lowerExtension(fileName) == ".trr" ? Format::TRR : Format::XTC), fd(-1),
+      data(nullptr), length(0), position(0), prefetched(0), xtcFile(nullptr),
+      xtcPosition(-1)
+  {
+    if(not isSupported(fileName))
+      return;
+
+    struct stat info;
+    fd = open(fileName.c_str(), O_RDONLY);
+    if(fd == -1)
+      return;
+
+    if(fstat(fd, &info) != 0 or info.st_size == 0)
+    {
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+      close(fd);
+      fd = -1;
+      return;
+    }
+
+    data = static_cast<const unsigned char*>(mapping);
+    length = info.st_size;
+    madvise(mapping, length, MADV_SEQUENTIAL);
+  }
+
+  MappedTrajectory::~MappedTrajectory()
+  {
+    if(xtcFile)
+      gmx_fio_close(xtcFile);
+    if(data)
+      munmap(const_cast<unsigned char*>(data), length);
+    if(fd != -1)
+      close(fd);
+  }
+
+  bool
+  MappedTrajectory::isSupported(const std::string& fileName)
+  {
+    const std::string extension = lowerExtension(fileName);
+    return extension == ".xtc" or extension == ".trr";
+  }
+
+  bool
+  MappedTrajectory::canDecode(const std::string& fileName)
+  {
+    return isSupported(fileName);
+  }
+
+  bool
+  MappedTrajectory::isOpen() const
+  {
+    return data != nullptr;
+  }
+
+  std::int64_t
+  MappedTrajectory::tell() const
+  {
+    return position;
+  }
+
+  bool
+  MappedTrajectory::seek(std::int64_t offset)
+  {
+    if(not data or offset < 0 or offset > length)
+      return false;
+
+    if(offset != position)
+    {
+      position = offset;
+      prefetched = 0;
+    }
+    return true;
+  }
+
+  bool
+  MappedTrajectory::skip(Header& header)
+  {
+    Layout layout;
+    if(not data or not parse(position, header, layout))
+      return false;
+
+    position += header.size;
+    return true;
+  }
+
+  bool
+  MappedTrajectory::next(t_trxframe& frame)
+  {
+    Header header;
+    Layout layout;
+
+    if(not data)
+      return false;
+
+    prefetch();
+    do
+    {
+      if(not parse(position, header, layout))
+        return false;
+      position += header.size;
+    }
+    while(not header.hasX);
+
+    if(header.natoms != frame.natoms)
+      return false;
+
+    for(unsigned int i = 0; i < DIM * DIM; i++)
+      frame.box[i / DIM][i % DIM] = xdrReal(data + layout.box
+                                            + i * layout.realSize,
+                                            layout.realSize);
+
+    if(format == Format::XTC)
+    {
+      if(not decodeXtc(header, frame))
+        return false;
+    }
+    else
+      decodeTrr(header, layout, frame);
+
+    frame.time = header.time;
+    frame.step = header.step;
+    return true;
+  }
+
+  bool
+  MappedTrajectory::parse(std::int64_t offset, Header& header,
+                          Layout& layout) const
+  {
+    if(format == Format::XTC)
+      return parseXtc(offset, header, layout);
+    else
+      return parseTrr(offset, header, layout);
+  }
+
+  bool
+  MappedTrajectory::parseXtc(std::int64_t offset, Header& header,
+                             Layout& layout) const
+  {
+    // Magic, atoms, step, time, box and the number of atoms again
+    if(offset + 14 * 4 > length)
+      return false;
+
+    const unsigned char* frame = data + offset;
+    if(static_cast<std::int32_t>(xdrUint(frame)) != xtcMagic)
+      return false;
+
+    header.natoms = xdrUint(frame + 4);
+    header.step = static_cast<std::int32_t>(xdrUint(frame + 8));
+    header.time = xdrFloat(frame + 12);
+    header.hasX = true;
+    layout.box = offset + 16;
+    layout.x = offset + 13 * 4;
+    layout.realSize = sizeof(float);
+
+    const std::uint32_t size = xdrUint(frame + 13 * 4);
+    std::int64_t end;
+    if(size <= 9)
+      end = offset + 14 * 4 + size * 3 * 4;
+    else
+    {
+      // Precision, minimum and maximum integers, smallidx and the bytes
+      if(offset + 23 * 4 > length)
+        return false;
+      end = offset + 23 * 4 + ((xdrUint(frame + 22 * 4) + 3) & ~3u);
+    }
+
+    if(end > length)
+      return false;
+
+    header.offset = offset;
+    header.size = end - offset;
+    return true;
+  }
+
+  bool
+  MappedTrajectory::parseTrr(std::int64_t offset, Header& header,
+                             Layout& layout) const
+  {
+    // Magic and the version string, stored with its length twice
+    if(offset + 3 * 4 > length)
+      return false;
+
+    const unsigned char* frame = data + offset;
+    if(static_cast<std::int32_t>(xdrUint(frame)) != trrMagic)
+      return false;
+
+    std::int64_t current = offset + 3 * 4 + ((xdrUint(frame + 8) + 3) & ~3u);
+    if(current + 13 * 4 > length)
+      return false;
+
+    enum
+    {
+      IR, E, BOX, VIR, PRES, TOP, SYM, X, V, F, NATOMS, STEP, NRE, NSIZES
+    };
+    std::uint32_t sizes[NSIZES];
+    for(unsigned int i = 0; i < NSIZES; i++)
+      sizes[i] = xdrUint(data + current + i * 4);
+    current += NSIZES * 4;
+
+    // Never written by GROMACS, their layout is unknown
+    if(sizes[IR] != 0 or sizes[E] != 0 or sizes[TOP] != 0 or sizes[SYM] != 0)
+      return false;
+
+    header.natoms = sizes[NATOMS];
+    header.step = static_cast<std::int32_t>(sizes[STEP]);
+    header.hasX = sizes[X] != 0;
+
+    // Single or double precision, from whatever has been stored
+    if(sizes[BOX] != 0)
+      layout.realSize = sizes[BOX] / (DIM * DIM);
+    else if(header.natoms > 0 and sizes[X] != 0)
+      layout.realSize = sizes[X] / (header.natoms * DIM);
+    else if(header.natoms > 0 and sizes[V] != 0)
+      layout.realSize = sizes[V] / (header.natoms * DIM);
+    else if(header.natoms > 0 and sizes[F] != 0)
+      layout.realSize = sizes[F] / (header.natoms * DIM);
+    else
+      return false;
+
+    if(layout.realSize != sizeof(float) and layout.realSize != sizeof(double))
+      return false;
+
+    // Time and lambda
+    if(current + 2 * layout.realSize > length)
+      return false;
+    header.time = xdrReal(data + current, layout.realSize);
+    current += 2 * layout.realSize;
+
+    layout.box = current;
+    layout.x = current + sizes[BOX] + sizes[VIR] + sizes[PRES];
+    const std::int64_t end = layout.x + sizes[X] + sizes[V] + sizes[F];
+    if(end > length or (sizes[BOX] == 0 and header.hasX))
+      return false;
+
+    header.offset = offset;
+    header.size = end - offset;
+    return true;
+  }
+
+  bool
+  MappedTrajectory::decodeXtc(const Header& header, t_trxframe& frame)
+  {
+    // Headers alone are read without it
+    if(not xtcFile)
+    {
+      xtcFile = gmx_fio_open(fileName.c_str(), "r");
+      if(not xtcFile)
+        return false;
+    }
+
+    // Sequential frames need no seek, GROMACS is already there
+    if(xtcPosition != header.offset
+       and gmx_fio_seek(xtcFile, header.offset) != 0)
+    {
+      xtcPosition = -1;
+      return false;
+    }
+
+#if GMXVER < 50
+    int step;
+#else
+    gmx_int64_t step;
+#endif
+    real time, precision;
+    gmx_bool ok;
+    const bool decoded = read_next_xtc(xtcFile, header.natoms, &step, &time,
+                                       frame.box, frame.x, &precision, &ok)
+                         and ok;
+
+    xtcPosition = decoded ? header.offset + header.size : -1;
+    return decoded;
+  }
+
+  void
+  MappedTrajectory::decodeTrr(const Header& header, const Layout& layout,
+                              t_trxframe& frame) const
+  {
+    const unsigned char* x = data + layout.x;
+    const unsigned int values = header.natoms * DIM;
+    for(unsigned int i = 0; i < values; i++)
+      frame.x[i / DIM][i % DIM] = xdrReal(x + i * layout.realSize,
+                                          layout.realSize);
+  }
+
+  void
+  MappedTrajectory::prefetch()
+  {
+    // Half of the window is still ahead
+    if(position + prefetchWindow / 2 < prefetched)
+      return;
+
+    const std::int64_t page = sysconf(_SC_PAGESIZE);
+    const std::int64_t start = position / page * page;
+    const std::int64_t size = std::min(prefetchWindow, length - start);
+    if(size > 0)
+      madvise(const_cast<unsigned char*>(data) + start, size, MADV_WILLNEED);
+    prefetched = start + size;
+  }
+}
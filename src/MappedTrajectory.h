@@ -0,0 +1,136 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MAPPEDTRAJECTORY_H
+#define _MAPPEDTRAJECTORY_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <cstdint>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  /**
+   * @brief Reads XTC and TRR frames straight from a memory mapped file
+   *
+   * Time control is not applied. XTC coordinates are decompressed by GROMACS
+   * from its own handle, moved to the frame found in the mapping.
+   */
+  class MappedTrajectory
+  {
+    public:
+      struct Header
+      {
+        std::int64_t offset;
+        // Whole frame, header included
+        std::int64_t size;
+        int natoms;
+        float time;
+        std::int64_t step;
+        // TRR frames can have no coordinates
+        bool hasX;
+      };
+
+      MappedTrajectory(const std::string& fileName);
+      ~MappedTrajectory();
+      MappedTrajectory(const MappedTrajectory&) = delete;
+      MappedTrajectory& operator =(const MappedTrajectory&) = delete;
+
+      bool isOpen() const;
+      std::int64_t tell() const;
+
+      /**
+       * @brief Moves to the frame starting at offset
+       */
+      bool seek(std::int64_t offset);
+
+      /**
+       * @brief Reads only the header of the current frame and skips it
+       * @return false at the end of the file or on a truncated frame
+       */
+      bool skip(Header& header);
+
+      /**
+       * @brief Decodes the next frame, of frame.natoms atoms, in frame
+       */
+      bool next(t_trxframe& frame);
+
+      /**
+       * @brief Whether a file can be mapped and its headers read
+       */
+      static bool isSupported(const std::string& fileName);
+
+      /**
+       * @brief Whether next() can decode the frames of a file
+       */
+      static bool canDecode(const std::string& fileName);
+
+    private:
+      enum class Format
+      {
+        XTC,
+        TRR
+      };
+
+      // Where the parts of a frame are, besides its header
+      struct Layout
+      {
+        std::int64_t box;
+        std::int64_t x;
+        // Bytes of a real in the file, 4 or 8
+        unsigned int realSize;
+      };
+
+      const std::string fileName;
+      Format format;
+      int fd;
+      const unsigned char* data;
+      std::int64_t length;
+      std::int64_t position;
+      std::int64_t prefetched;
+      // GROMACS handle used to decompress XTC frames, opened when needed
+      t_fileio* xtcFile;
+      // Offset of xtcFile, -1 when unknown
+      std::int64_t xtcPosition;
+
+      bool parse(std::int64_t offset, Header& header, Layout& layout) const;
+      bool parseXtc(std::int64_t offset, Header& header,
+                    Layout& layout) const;
+      bool parseTrr(std::int64_t offset, Header& header,
+                    Layout& layout) const;
+      bool decodeXtc(const Header& header, t_trxframe& frame);
+      void decodeTrr(const Header& header, const Layout& layout,
+                     t_trxframe& frame) const;
+      void prefetch();
+  };
+}
+
+#endif /* _MAPPEDTRAJECTORY_H */
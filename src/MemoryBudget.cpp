@@ -0,0 +1,213 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MemoryBudget.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <sys/sysinfo.h>
+
+namespace PstpFinder
+{
+  // Used when not even the free RAM can be known
+  static constexpr unsigned long fallbackBudget = 134217728; // 128 MB
+  // cgroup v1 reports no limit as a huge number, rounded to the page size
+  static constexpr unsigned long unlimited = 1ul << 62;
+
+  MemoryBudget&
+  MemoryBudget::instance()
+  {
+    static MemoryBudget budget;
+    return budget;
+  }
+
+  MemoryBudget::MemoryBudget() :
+      budget(fallbackBudget), users(0)
+  {
+  }
+
+  void
+  MemoryBudget::attach()
+  {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    measure();
+    users++;
+  }
+
+  void
+  MemoryBudget::detach()
+  {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    if(users > 0)
+      users--;
+  }
+
+  unsigned long
+  MemoryBudget::share() const
+  {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    return budget / std::max(users, 1u);
+  }
+
+  unsigned long
+  MemoryBudget::getBudget() const
+  {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    return budget;
+  }
+
+  unsigned int
+  MemoryBudget::getUsers() const
+  {
+    std::lock_guard<std::mutex> lock(budgetMutex);
+    return users;
+  }
+
+  void
+  MemoryBudget::measure()
+  {
+    unsigned long available, limit;
+    if(not availableMemory(available, limit))
+    {
+      budget = fallbackBudget;
+      return;
+    }
+
+    /*
+     * What the users already buffer is not available anymore, but it is
+     * still theirs: the budget does not shrink because of it.
+     */
+    budget = std::max(static_cast<unsigned long>(available * 0.8),
+                      users > 0 ? budget : 0ul);
+    budget = std::min(budget, limit / 4);
+  }
+
+  bool
+  MemoryBudget::availableMemory(unsigned long& available,
+                                unsigned long& limit)
+  {
+    available = 0;
+    limit = 0;
+
+    // MemAvailable counts the caches that can be dropped, freeram does not
+    std::ifstream meminfo("/proc/meminfo");
+    std::string line;
+    while(std::getline(meminfo, line))
+    {
+      std::istringstream fields(line);
+      std::string name;
+      unsigned long kBytes;
+      if(not (fields >> name >> kBytes))
+        continue;
+
+      if(name == "MemTotal:")
+        limit = kBytes * 1024;
+      else if(name == "MemAvailable:")
+        available = kBytes * 1024;
+    }
+
+    if(limit == 0 or available == 0)
+    {
+      struct sysinfo info;
+      if(sysinfo(&info) != 0)
+        return false;
+
+      limit = static_cast<unsigned long>(info.totalram) * info.mem_unit;
+      available = static_cast<unsigned long>(info.freeram + info.bufferram)
+                  * info.mem_unit;
+    }
+
+    cgroupMemory(available, limit);
+    return true;
+  }
+
+  void
+  MemoryBudget::cgroupMemory(unsigned long& available, unsigned long& limit)
+  {
+    /*
+     * Every line is "id:controllers:path". The unified hierarchy (v2) has
+     * id 0 and no controllers, v1 has a line with the memory controller.
+     */
+    std::ifstream cgroups("/proc/self/cgroup");
+    std::string line;
+    while(std::getline(cgroups, line))
+    {
+      const std::size_t first = line.find(':');
+      const std::size_t second = line.find(':', first + 1);
+      if(first == std::string::npos or second == std::string::npos)
+        continue;
+
+      const std::string controllers = line.substr(first + 1,
+                                                  second - first - 1);
+      std::string path = line.substr(second + 1);
+      std::string root, limitFile, usageFile;
+      if(controllers.empty())
+      {
+        root = "/sys/fs/cgroup";
+        limitFile = "memory.max";
+        usageFile = "memory.current";
+      }
+      else if(("," + controllers + ",").find(",memory,") != std::string::npos)
+      {
+        root = "/sys/fs/cgroup/memory";
+        limitFile = "memory.limit_in_bytes";
+        usageFile = "memory.usage_in_bytes";
+      }
+      else
+        continue;
+
+      /*
+       * Any ancestor can have a tighter limit. Inside a container the path
+       * may not exist, the cgroup of the container is then mounted as root.
+       */
+      while(true)
+      {
+        const std::string directory = root + (path == "/" ? "" : path) + "/";
+        unsigned long groupLimit, usage;
+        if(readValue(directory + limitFile, groupLimit)
+           and groupLimit < unlimited)
+        {
+          limit = std::min(limit, groupLimit);
+          if(readValue(directory + usageFile, usage))
+            available = std::min(available,
+                                 groupLimit > usage ? groupLimit - usage : 0);
+        }
+
+        if(path.empty() or path == "/")
+          break;
+        const std::size_t slash = path.rfind('/');
+        path = slash == 0 or slash == std::string::npos ?
+               "/" : path.substr(0, slash);
+      }
+    }
+  }
+
+  bool
+  MemoryBudget::readValue(const std::string& fileName, unsigned long& value)
+  {
+    std::ifstream file(fileName);
+    std::string text;
+    if(not (file >> text) or text == "max")
+      return false;
+
+    std::istringstream number(text);
+    return static_cast<bool>(number >> value);
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMORYBUDGET_H
+#define _MEMORYBUDGET_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <mutex>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Memory the whole process can use to buffer SAS chunks
+   *
+   * 80% of the free RAM or cgroup headroom, measured on attach() and shared
+   * equally between the SasAnalysis instances attached.
+   */
+  class MemoryBudget
+  {
+    public:
+      static MemoryBudget& instance();
+      MemoryBudget(const MemoryBudget&) = delete;
+      MemoryBudget& operator =(const MemoryBudget&) = delete;
+
+      void attach();
+      void detach();
+
+      /**
+       * @brief Bytes every user can take now
+       */
+      unsigned long share() const;
+      unsigned long getBudget() const;
+      unsigned int getUsers() const;
+
+      /**
+       * @brief Bytes the process can still allocate, considering cgroups
+       * @param limit Set to the most the process could ever have
+       * @return false if even free RAM can't be known
+       */
+      static bool availableMemory(unsigned long& available,
+                                  unsigned long& limit);
+
+    private:
+      mutable std::mutex budgetMutex;
+      unsigned long budget;
+      unsigned int users;
+
+      MemoryBudget();
+      void measure();
+      static void cgroupMemory(unsigned long& available,
+                               unsigned long& limit);
+      static bool readValue(const std::string& fileName,
+                            unsigned long& value);
+  };
+}
+
+#endif /* _MEMORYBUDGET_H */
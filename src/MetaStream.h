@@ -398,6 +398,15 @@ namespace PstpFinder
         T::close();
       }
 
+      /**
+       * @brief Ends the stream after size bytes, once the file is cut there
+       */
+      void
+      setSize(off_type size)
+      {
+        streamEnd = streamBegin + size;
+      }
+
     protected:
       off_type streamBegin;
       off_type streamEnd;
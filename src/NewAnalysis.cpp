@@ -33,6 +33,8 @@
 #include <fstream>
 #include <string>
 #include <future>
+#include <thread>
+#include <algorithm>
 
 namespace PstpFinder
 {
@@ -114,11 +116,25 @@ namespace PstpFinder
     hboxEnd.set_homogeneous(false);
     hboxEnd.set_spacing(10);
 
+    labelDecodeThreads.set_label("Decoding threads:");
+    spinDecodeThreads.set_digits(0);
+    spinDecodeThreads.set_increments(1, 4);
+    const unsigned int cpus = std::max(std::thread::hardware_concurrency(),
+                                       1u);
+    spinDecodeThreads.set_range(1, cpus);
+    // Decoding is much faster than SAS, most of the cores go to the latter
+    spinDecodeThreads.set_value((cpus + 3) / 4);
+    hboxDecodeThreads.pack_start(labelDecodeThreads, Gtk::PACK_SHRINK);
+    hboxDecodeThreads.pack_start(spinDecodeThreads);
+    hboxDecodeThreads.set_homogeneous(false);
+    hboxDecodeThreads.set_spacing(10);
+
     vboxFrame1.set_spacing(10);
     vboxFrame1.pack_start(hboxTrajectory, Gtk::PACK_EXPAND_PADDING);
     vboxFrame1.pack_start(hboxTopology, Gtk::PACK_EXPAND_PADDING);
     vboxFrame1.pack_start(hboxBegin, Gtk::PACK_EXPAND_PADDING);
     vboxFrame1.pack_start(hboxEnd, Gtk::PACK_EXPAND_PADDING);
+    vboxFrame1.pack_start(hboxDecodeThreads, Gtk::PACK_EXPAND_PADDING);
 
     labelRadius.set_label("Pocket radius:");
     spinRadius.set_digits(1);
@@ -142,6 +158,42 @@ namespace PstpFinder
     hboxPocketThreshold.pack_start(spinPocketThreshold);
     hboxPocketThreshold.pack_start(labelPs, Gtk::PACK_SHRINK);
 
+    labelSasDots.set_label("SAS dots per atom:");
+    spinSasDots.set_digits(0);
+    spinSasDots.set_increments(1, 10);
+    spinSasDots.set_range(1, 2000);
+    spinSasDots.set_value(24);
+    checkAdaptiveSas.set_label("Adaptive");
+    checkStridedSas.set_label("Every " + std::to_string(PS_PER_SAS) + " ps");
+    checkLegacySas.set_label("Legacy nsc");
+    checkLegacySas.set_active(true);
+    hboxSasDots.set_spacing(10);
+    hboxSasDots.pack_start(labelSasDots, Gtk::PACK_SHRINK);
+    hboxSasDots.pack_start(spinSasDots);
+    hboxSasDots.pack_start(checkAdaptiveSas, Gtk::PACK_SHRINK);
+    hboxSasDots.pack_start(checkStridedSas, Gtk::PACK_SHRINK);
+    hboxSasDots.pack_start(checkLegacySas, Gtk::PACK_SHRINK);
+
+    labelSasOptions.set_label("SAS options:");
+    checkIncrementalSas.set_label("Incremental");
+    hboxSasOptions.set_spacing(10);
+    hboxSasOptions.pack_start(labelSasOptions, Gtk::PACK_SHRINK);
+    hboxSasOptions.pack_start(checkIncrementalSas, Gtk::PACK_SHRINK);
+    // SAS only, compressed: a fraction of the size, but values are rounded
+    checkCompactSas.set_label("Compact storage");
+    checkCompactSas.set_active(false);
+    hboxSasOptions.pack_start(checkCompactSas, Gtk::PACK_SHRINK);
+
+    checkNeighbourhoodSas.set_label("Protein neighbourhood within");
+    spinNeighbourhoodCutoff.set_digits(2);
+    spinNeighbourhoodCutoff.set_increments(0.05, 0.5);
+    spinNeighbourhoodCutoff.set_range(0.0, 5.0);
+    spinNeighbourhoodCutoff.set_value(0.6);
+    labelNm.set_label("nm");
+    hboxSasOptions.pack_start(checkNeighbourhoodSas, Gtk::PACK_SHRINK);
+    hboxSasOptions.pack_start(spinNeighbourhoodCutoff);
+    hboxSasOptions.pack_start(labelNm, Gtk::PACK_SHRINK);
+
     labelSessionFile.set_label("Session file:");
     buttonBrowseFile.set_label("Browse...");
     buttonBrowseFile.signal_clicked().connect(
@@ -156,6 +208,8 @@ namespace PstpFinder
     vboxFrame2.set_spacing(10);
     vboxFrame2.pack_start(hboxRadius);
     vboxFrame2.pack_start(hboxPocketThreshold);
+    vboxFrame2.pack_start(hboxSasDots);
+    vboxFrame2.pack_start(hboxSasOptions);
     vboxFrame2.pack_start(hboxSession);
 
     hboxFrame.set_spacing(10);
@@ -299,6 +353,16 @@ namespace PstpFinder
 
     gromacs->setBegin(spinBegin.get_value());
     gromacs->setEnd(spinEnd.get_value());
+    gromacs->sasDots(spinSasDots.get_value());
+    gromacs->adaptiveSas(checkAdaptiveSas.get_active());
+    gromacs->useLegacySas(checkLegacySas.get_active());
+    gromacs->incrementalSas(checkIncrementalSas.get_active());
+    gromacs->compactSas(checkNeighbourhoodSas.get_active());
+    gromacs->compactSasCutoff(spinNeighbourhoodCutoff.get_value());
+    gromacs->decodeThreads(spinDecodeThreads.get_value());
+    if(checkStridedSas.get_active())
+      // Pittpi bins SAS anyway, one frame per bin is enough
+      gromacs->sasStride(PS_PER_SAS / gromacs->getTimeStep());
 
     mainFrame.set_sensitive(false);
     buttonShowResults.set_sensitive(false);
@@ -306,13 +370,10 @@ namespace PstpFinder
 
     Session<std::ofstream> session(sessionFileName, *gromacs,
                                    spinRadius.get_value(),
-                                   spinPocketThreshold.get_value());
-
-    calculateSas(session);
-    if(abortFlag)
-      return;
+                                   spinPocketThreshold.get_value(),
+                                   checkCompactSas.get_active());
 
-    calculateAverageStructure(session);
+    calculateSasAndAverageStructure(session);
     if(abortFlag)
       return;
 
@@ -443,6 +504,15 @@ namespace PstpFinder
     endTime = session.getEndTime();
     spinRadius.set_value(session.getRadius());
     spinPocketThreshold.set_value(session.getPocketThreshold());
+    spinSasDots.set_value(session.getSasDots());
+    checkAdaptiveSas.set_active(session.isSasAdaptive());
+    checkStridedSas.set_active(session.getSasStride() > 1);
+    checkLegacySas.set_active(session.isSasLegacy());
+    checkIncrementalSas.set_active(session.isSasIncremental());
+    checkCompactSas.set_active(session.isSasCompact());
+    checkNeighbourhoodSas.set_active(session.isSasNeighbourhood());
+    if(session.isSasNeighbourhood())
+      spinNeighbourhoodCutoff.set_value(session.getSasNeighbourhoodCutoff());
     entrySessionFile.set_text(sessionFileName);
 
     mainFrame.set_sensitive(false);
@@ -460,6 +530,16 @@ namespace PstpFinder
     __frames = gromacs->getFramesCount();
     gromacs->setBegin(beginTime);
     gromacs->setEnd(endTime);
+    gromacs->sasDots(session.getSasDots());
+    gromacs->adaptiveSas(session.isSasAdaptive());
+    gromacs->sasStride(session.getSasStride());
+    // Stored SAS and the rest of the frames must come from the same engine
+    gromacs->useLegacySas(session.isSasLegacy());
+    gromacs->incrementalSas(session.isSasIncremental());
+    gromacs->compactSas(session.isSasNeighbourhood());
+    if(session.isSasNeighbourhood())
+      gromacs->compactSasCutoff(session.getSasNeighbourhoodCutoff());
+    gromacs->decodeThreads(spinDecodeThreads.get_value());
     spinBegin.set_value(beginTime);
     spinEnd.set_value(endTime);
 
@@ -467,11 +547,7 @@ namespace PstpFinder
     {
       stop_spin();
 
-      calculateSas(session);
-      if(abortFlag)
-        return;
-
-      calculateAverageStructure(session);
+      calculateSasAndAverageStructure(session);
       if(abortFlag)
         return;
     }
@@ -577,9 +653,10 @@ namespace PstpFinder
 
   template<typename Session>
   void
-  NewAnalysis::calculateSas(Session& session)
+  NewAnalysis::calculateSasAndAverageStructure(Session& session)
   {
-    statusBar.push("Calculating SAS using Gromacs", statusBarContext);
+    statusBar.push("Calculating SAS and average structure using Gromacs",
+                   statusBarContext);
     progress.set_fraction(0);
     while(Gtk::Main::events_pending())
       Gtk::Main::iteration();
@@ -591,47 +668,7 @@ namespace PstpFinder
 
     if(abortFlag)
       return;
-    gromacs->calculateSas(session);
-
-    while((currentFrame = gromacs->getCurrentFrame()) < count)
-    {
-      if(abortFlag)
-      {
-        gromacs->abort();
-        break;
-      }
-      progress.set_fraction(static_cast<float>(currentFrame) / count);
-      std::future<void> nextFrame = std::async(std::launch::async, std::mem_fn<void() const>(&Gromacs::waitNextFrame), &*gromacs);
-      do
-      {
-        while(Gtk::Main::events_pending())
-          Gtk::Main::iteration();
-      } while(nextFrame.wait_for(std::chrono::milliseconds(300)) != std::future_status::ready);
-    }
-    if(abortFlag)
-      return;
-
-    gromacs->waitOperation();
-    while(Gtk::Main::events_pending())
-      Gtk::Main::iteration();
-
-    progress.set_fraction(1);
-    while(Gtk::Main::events_pending())
-      Gtk::Main::iteration();
-  }
-
-  template<typename Session>
-  void
-  NewAnalysis::calculateAverageStructure(Session& session)
-  {
-    statusBar.push("Calculating average structure", statusBarContext);
-    progress.set_fraction(0);
-    while(Gtk::Main::events_pending())
-      Gtk::Main::iteration();
-
-    unsigned int currentFrame;
-    unsigned int count(gromacs->getFramesCount());
-    gromacs->calculateAverageStructure();
+    gromacs->calculateSasAndAverageStructure(session);
 
     while((currentFrame = gromacs->getCurrentFrame()) < count)
     {
@@ -641,7 +678,6 @@ namespace PstpFinder
         break;
       }
       progress.set_fraction(static_cast<float>(currentFrame) / count);
-
       std::future<void> nextFrame = std::async(std::launch::async, std::mem_fn<void() const>(&Gromacs::waitNextFrame), &*gromacs);
       do
       {
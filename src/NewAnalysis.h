@@ -67,15 +67,20 @@ namespace PstpFinder
       Gtk::FileChooserButton trjChooser, tprChooser;
       Gtk::Label labelTrajectory, labelTopology, labelBegin, labelEnd,
           labelRadius, labelPocketThreshold, labelPs, labelAngstrom,
-          labelSessionFile;
+          labelSessionFile, labelSasDots, labelSasOptions, labelNm,
+          labelDecodeThreads;
       Gtk::HBox hboxTrajectory, hboxTopology, hboxBegin, hboxEnd, hboxFrame,
-          hboxRadius, hboxPocketThreshold, hboxSession;
+          hboxRadius, hboxPocketThreshold, hboxSession, hboxSasDots,
+          hboxSasOptions, hboxDecodeThreads;
       Gtk::Entry entrySessionFile;
       Gtk::HButtonBox buttonBoxRun, buttonBoxBrowse;
       Gtk::Button buttonRun, buttonBrowseFile, buttonShowResults;
       Gtk::ProgressBar progress;
       Gtk::Alignment progressAligner;
-      Gtk::SpinButton spinBegin, spinEnd, spinRadius, spinPocketThreshold;
+      Gtk::SpinButton spinBegin, spinEnd, spinRadius, spinPocketThreshold,
+          spinSasDots, spinNeighbourhoodCutoff, spinDecodeThreads;
+      Gtk::CheckButton checkAdaptiveSas, checkStridedSas, checkLegacySas,
+          checkIncrementalSas, checkNeighbourhoodSas, checkCompactSas;
       Gtk::HScale hScaleBegin, hScaleEnd;
       Gtk::Spinner spinnerWait;
       Gtk::VSeparator vSeparator;
@@ -106,10 +111,7 @@ namespace PstpFinder
       void runPittpi(const std::string& SessionFileName, float radius,
                      float threshold);
       template<typename Session>
-      void calculateSas(Session& session);
-
-      template<typename Session>
-      void calculateAverageStructure(Session& session);
+      void calculateSasAndAverageStructure(Session& session);
   };
 }
 
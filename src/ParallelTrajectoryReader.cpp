@@ -0,0 +1,213 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ParallelTrajectoryReader.h"
+
+#include <algorithm>
+
+#if GMXVER < 50
+/* Workaround - is not defined as "C", let's include it before others */
+extern "C"
+{
+#include <gromacs/gmxfio.h>
+}
+
+#include <gromacs/statutil.h>
+#include <gromacs/xtcio.h>
+#include <gromacs/smalloc.h>
+#else
+#include <gromacs/fileio/trxio.h>
+#include <gromacs/fileio/xtcio.h>
+#include <gromacs/fileio/gmxfio.h>
+#include <gromacs/utility/smalloc.h>
+#endif
+
+#include "utils.h"
+
+namespace PstpFinder
+{
+  // Decoded frames that can be kept in memory, in bytes
+  static constexpr unsigned long frameBudget = 64ul << 20;
+  static constexpr unsigned int maxChunkFrames = 32;
+
+  ParallelTrajectoryReader::ParallelTrajectoryReader(
+      const std::string& fileName, int natoms, real firstTime,
+      real lastTime, real timeStep, unsigned int nThreads,
+      const FrameIndex* index) :
+      fileName(fileName), natoms(natoms), firstTime(firstTime),
+      lastTime(lastTime), timeStep(timeStep),
+      index(index and index->isSeekable() ? index : nullptr), currentChunk(0),
+      currentFrame(0)
+  {
+    if(nThreads == 0)
+      nThreads = 1;
+
+    /*
+     * Every thread has a chunk waiting in its queue and one being decoded,
+     * the consumer holds another one.
+     */
+    const unsigned long frameBytes = natoms * DIM * sizeof(real);
+    const unsigned long inFlight = (2 * nThreads + 1) * frameBytes;
+    chunkFrames = std::max<unsigned long>(1, std::min<unsigned long>(
+        maxChunkFrames, frameBudget / inFlight));
+
+    for(unsigned int i = 0; i < nThreads; i++)
+      chunks.emplace_back(new BoundedQueue<Chunk>(1));
+
+    threads.reserve(nThreads);
+    for(unsigned int i = 0; i < nThreads; i++)
+      threads.emplace_back(&ParallelTrajectoryReader::decode, this, i);
+  }
+
+  ParallelTrajectoryReader::~ParallelTrajectoryReader()
+  {
+    for(std::unique_ptr<BoundedQueue<Chunk>>& queue : chunks)
+      queue->close();
+    for(std::thread& thread : threads)
+      thread.join();
+  }
+
+  bool
+  ParallelTrajectoryReader::isSupported(const std::string& fileName)
+  {
+    std::string extension = file_extension(fileName);
+    std::transform(std::begin(extension), std::end(extension),
+                   std::begin(extension), ::tolower);
+    return extension == ".xtc";
+  }
+
+  bool
+  ParallelTrajectoryReader::next(t_trxframe& frame)
+  {
+    while(currentFrame >= current.size())
+    {
+      if(not chunks[currentChunk % chunks.size()]->pop(current))
+        return false;
+
+      currentChunk++;
+      currentFrame = 0;
+    }
+
+    const TrajectoryFrame& decoded = current[currentFrame++];
+    std::copy(std::begin(decoded.x), std::end(decoded.x), frame.x[0]);
+    std::copy(decoded.box[0], decoded.box[0] + DIM * DIM, frame.box[0]);
+    frame.time = decoded.time;
+    frame.step = decoded.step;
+
+    return true;
+  }
+
+  void
+  ParallelTrajectoryReader::decode(unsigned int thread)
+  {
+    BoundedQueue<Chunk>& queue = *chunks[thread];
+    output_env_t oenv;
+    t_trxstatus* status;
+    t_trxframe fr;
+
+#if GMXVER < 50
+    snew(oenv, 1);
+    output_env_init_default(oenv);
+#else
+    output_env_init_default(&oenv);
+#endif
+
+    if(not read_first_frame(oenv, &status, fileName.c_str(), &fr, TRX_NEED_X))
+    {
+      output_env_done(oenv);
+      queue.close();
+      return;
+    }
+
+    t_fileio* fio = trx_get_fileio(status);
+    // The last frame read is beyond its chunk, it can belong to the next one
+    bool pending = false;
+    bool more = true;
+    for(unsigned int chunk = thread; more; chunk += chunks.size())
+    {
+      const real begin = firstTime + (chunk * chunkFrames + 0.5) * timeStep;
+      const real end = begin + chunkFrames * timeStep;
+      if(begin > lastTime)
+        break;
+
+      Chunk frames;
+      if(pending and fr.time >= end)
+      {
+        // A hole in the trajectory, nothing for this chunk
+        if(not queue.push(std::move(frames)))
+          break;
+        continue;
+      }
+
+      if(fr.time < begin - timeStep * 1.5)
+      {
+        if(index)
+        {
+          const std::size_t frame = index->find(begin);
+          if(frame == index->size())
+            break;
+          gmx_fio_seek(fio, (*index)[frame].offset);
+        }
+        else
+        {
+          // Land a frame before, the seek is not exact
+#if GMXVER < 50
+          xtc_seek_time(begin - timeStep, fio, natoms);
+#else
+          xtc_seek_time(fio, begin - timeStep, natoms, FALSE);
+#endif
+        }
+      }
+
+      auto store = [&]()
+      {
+        frames.emplace_back();
+        TrajectoryFrame& frame = frames.back();
+        frame.x.assign(fr.x[0], fr.x[0] + natoms * DIM);
+        std::copy(fr.box[0], fr.box[0] + DIM * DIM, frame.box[0]);
+        frame.time = fr.time;
+        frame.step = fr.step;
+      };
+
+      frames.reserve(chunkFrames);
+      if(pending and fr.time >= begin)
+        store();
+      pending = false;
+
+      while((more = read_next_frame(oenv, status, &fr)))
+      {
+        if(fr.time < begin)
+          continue;
+        if(fr.time >= end)
+        {
+          pending = true;
+          break;
+        }
+        store();
+      }
+
+      if(not queue.push(std::move(frames)))
+        break;
+    }
+
+    queue.close();
+    close_trx(status);
+    output_env_done(oenv);
+  }
+}
@@ -0,0 +1,103 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PARALLELTRAJECTORYREADER_H
+#define _PARALLELTRAJECTORYREADER_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "BoundedQueue.h"
+#include "FrameIndex.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  struct TrajectoryFrame
+  {
+    std::vector<real> x;
+    matrix box;
+    real time;
+    decltype(t_trxframe::step) step;
+  };
+
+  /**
+   * @brief Decodes an XTC trajectory with more than one handle at a time
+   *
+   * Chunks of frames go round robin to threads with their own handle, next()
+   * returns frames in order. The first frame is left to the opening handle.
+   */
+  class ParallelTrajectoryReader
+  {
+    public:
+      ParallelTrajectoryReader(const std::string& fileName, int natoms,
+                               real firstTime, real lastTime, real timeStep,
+                               unsigned int nThreads,
+                               const FrameIndex* index = nullptr);
+      ~ParallelTrajectoryReader();
+      ParallelTrajectoryReader(const ParallelTrajectoryReader&) = delete;
+      ParallelTrajectoryReader& operator =(const ParallelTrajectoryReader&) =
+          delete;
+
+      /**
+       * @brief Copies the next frame in frame
+       * @return false at the end of the trajectory
+       */
+      bool next(t_trxframe& frame);
+
+      /**
+       * @brief Whether a file can be read in parallel (XTC only)
+       */
+      static bool isSupported(const std::string& fileName);
+
+    private:
+      typedef std::vector<TrajectoryFrame> Chunk;
+
+      const std::string fileName;
+      const int natoms;
+      const real firstTime;
+      const real lastTime;
+      const real timeStep;
+      const FrameIndex* index;
+      unsigned int chunkFrames;
+      std::vector<std::unique_ptr<BoundedQueue<Chunk>>> chunks;
+      std::vector<std::thread> threads;
+      Chunk current;
+      unsigned int currentChunk;
+      unsigned int currentFrame;
+
+      void decode(unsigned int thread);
+  };
+}
+
+#endif /* _PARALLELTRAJECTORYREADER_H */
@@ -19,11 +19,14 @@
 
 #include "Pittpi.h"
 #include "SasAtom.h"
+#include "MappedSasStream.h"
+#include "SasColumns.h"
 #include "SasAnalysis.h"
 
 #include <utility>
 #include <cassert>
 #include <future>
+#include <iostream>
 
 #ifdef HAVE_PYMOD_SADIC
 #include "PyIter.h"
@@ -292,7 +295,6 @@ namespace PstpFinder
     makeGroups(radius);
     if(abortFlag) return;
 
-#define PS_PER_SAS 5
     unsigned int const frameStep = float(PS_PER_SAS) / gromacs.getTimeStep();
     fillGroups(sessionFileName, frameStep);
     if(abortFlag) return;
@@ -616,52 +618,227 @@ namespace PstpFinder
   void
   Pittpi::fillGroups(const string& sessionFileName, unsigned int timeStep)
   {
-    std::vector<SasAtom> sasAtoms;
     unsigned int counter = 0;
 
     const float frames = gromacs.getFramesCount();
+    // Stored SAS frame j comes from frame j * stride of the trajectory
+    const unsigned int stride = gromacs.sasStride();
     vector<int> protein = gromacs.getGroup("Protein");
     const int nAtoms = protein.size();
 
     vector<float> meanSas(nAtoms);
 
+    /*
+     * SAS frames are viewed straight from a mapping of the session when
+     * possible, otherwise they are read through SasAnalysis. Reading stops
+     * as soon as process returns false. A damaged chunk stops the mapping,
+     * then SasAnalysis goes on from there, leaving empty the frames it
+     * can't read either.
+     */
+    MappedSasStream mappedSas(sessionFileName, nAtoms);
+    auto readSas = [&](const std::function<bool(const SasSpan&)>& process)
+    {
+      unsigned long mappedFrames = 0;
+      if(mappedSas.isOpen())
+      {
+        SasSpan frame;
+        mappedSas.rewind();
+        while(mappedSas.next(frame))
+        {
+          if(abortFlag or not process(frame))
+            return;
+          mappedFrames++;
+        }
+
+        if(not mappedSas.isDamaged())
+          return;
+        cerr << "Warning: damaged SAS stream after " << mappedFrames
+             << " frames, reading the rest without mapping." << endl;
+      }
+
+      // Whole chunks are decoded in parallel and viewed without copies
+      std::vector<const SasAtom*> sasFrames;
+      SasAnalysis<ifstream> sasAnalysis(gromacs, sessionFileName);
+      unsigned long skippedFrames = 0;
+      while(sasAnalysis.read(sasFrames))
+      {
+        for(const SasAtom* sasFrame : sasFrames)
+        {
+          // Already processed from the mapping
+          if(skippedFrames < mappedFrames)
+          {
+            skippedFrames++;
+            continue;
+          }
+
+          const SasSpan frame { &sasFrame->sas,
+                                sizeof(SasAtom) / sizeof(real) };
+          if(abortFlag or not process(frame))
+            return;
+        }
+      }
+    };
+
+    /*
+     * With the SAS stored atom by atom, only the H atoms of the groups are
+     * read, and never the whole frames.
+     */
+    SasColumns columns;
+    const bool columnar = columns.load(sessionFileName, nAtoms);
+    vector<unsigned int> usedAtoms;
+    if(columnar)
+    {
+      for(const Group& group : groups)
+      {
+        usedAtoms.push_back(group.getCentralH().index - 1);
+        for(const Residue<SasPdbAtom>* residue : group.getResidues())
+        {
+          const SasPdbAtom& atomH = residue->getAtomByType("H");
+          if(atomH.getTrimmedAtomType() != "UNK")
+            usedAtoms.push_back(atomH.index - 1);
+        }
+      }
+      sort(begin(usedAtoms), end(usedAtoms));
+      usedAtoms.erase(unique(begin(usedAtoms), end(usedAtoms)),
+                      end(usedAtoms));
+    }
+
     /* First of all we need to calculate SAS means */
     setStatusDescription("Calculating SAS means");
     setStatus(0);
+    if(columnar)
     {
-      SasAnalysis<ifstream> sasAnalysis(gromacs, sessionFileName);
-      while(sasAnalysis.read(sasAtoms))
+      // Columns are independent, each task sums some of them
+      const unsigned long nFrames = columns.getFramesCount();
+      const unsigned int nTasks = max(thread::hardware_concurrency(), 1u);
+      vector<future<void>> tasks;
+      for(unsigned int task = 0; task < nTasks; task++)
       {
-        if(abortFlag) return;
+        tasks.push_back(async(launch::async, [&, task]()
+        {
+          for(size_t i = task; i < usedAtoms.size(); i += nTasks)
+          {
+            if(abortFlag) return;
+            const float* column = columns.column(usedAtoms[i]);
+            float sum = 0;
+            for(unsigned long frame = 0; frame < nFrames; frame++)
+              sum += column[frame];
+            meanSas[usedAtoms[i]] = sum;
+          }
+        }));
+      }
+      for(future<void>& task : tasks)
+        task.get();
 
-        std::transform(std::begin(sasAtoms), std::end(sasAtoms),
-            std::begin(meanSas), std::begin(meanSas),
-            [](const SasAtom& a, float b){return a.sas + b;});
+      counter = nFrames;
+    }
+    else
+    {
+      readSas([&](const SasSpan& frame)
+      {
+        for(int i = 0; i < nAtoms; i++)
+          meanSas[i] += frame[i];
 
         counter++;
-        setStatus(static_cast<float>(counter) / gromacs.getFramesCount());
-      }
-
-      for(float& sas : meanSas)
-        sas /= counter;
+        setStatus(static_cast<float>(counter) * stride / frames);
+        return true;
+      });
     }
+    if(abortFlag) return;
+
+    for(float& sas : meanSas)
+      sas /= counter;
 
     /* Let's prepare groups sas vectors */
     for(Group& group : groups)
       group.sas.reserve(frames);
 
     /* Now we have to normalize values and store results per group */
-    std::vector<float> sas(protein.size());
     std::vector<float> sasCounters(protein.size());
+    unsigned int binSamples = 0;
+    unsigned int currentBin = 0;
+
+    /*
+     * Every bin is averaged and pushed for each group. When SAS has been
+     * calculated with a stride wider than a bin, the bins without samples
+     * hold the value of the last one.
+     */
+    auto pushBin = [&](unsigned int repeat) -> bool
+    {
+      for(auto& sasCounter : sasCounters)
+        sasCounter /= binSamples;
+
+      if(abortFlag) return false;
+
+      for(Group& group : groups)
+      {
+        if(abortFlag) return false;
+        float curFrame = 0;
+
+        if(sasCounters[group.getCentralH().index - 1] >= 0.000001)
+        {
+          const vector<const Residue<SasPdbAtom>*>& residues = group.getResidues();
+          for(const Residue<SasPdbAtom>* const& residuePtr : residues)
+          {
+            if(abortFlag) return false;
+            const SasPdbAtom& atomH = residuePtr->getAtomByType("H");
+            if(atomH.getTrimmedAtomType() == "UNK")
+              continue;
+
+            if(meanSas[atomH.index - 1] != 0)
+              curFrame += sasCounters[atomH.index - 1]
+                          / meanSas[atomH.index - 1];
+          }
+
+          curFrame /= group.getResidues().size();
+        }
+
+        group.sas.insert(group.sas.end(), repeat, curFrame);
+        if(curFrame < 0.000001)
+          group.zeros += repeat;
+      }
+
+      return true;
+    };
+
     setStatusDescription("Searching for zeros and normalizing SAS");
     setStatus(0);
     counter = 0;
+    if(columnar)
     {
-      SasAnalysis<ifstream> sasAnalysis(gromacs, sessionFileName);
-      while(sasAnalysis.read(sasAtoms))
+      // Frames of a bin are summed column by column, in the same order
+      const unsigned long nFrames = columns.getFramesCount();
+      while(counter < nFrames)
       {
         if(abortFlag) return;
 
+        const unsigned int bin = counter * stride / timeStep;
+        if(binSamples > 0 and not pushBin(bin - currentBin))
+          return;
+
+        unsigned int binEnd = counter + 1;
+        while(binEnd < nFrames and binEnd * stride / timeStep == bin)
+          binEnd++;
+
+        for(unsigned int atom : usedAtoms)
+        {
+          const float* column = columns.column(atom);
+          float sum = 0;
+          for(unsigned int frame = counter; frame < binEnd; frame++)
+            sum += column[frame];
+          sasCounters[atom] = sum;
+        }
+
+        currentBin = bin;
+        binSamples = binEnd - counter;
+        counter = binEnd;
+        setStatus(static_cast<float>(counter) * stride / frames);
+      }
+    }
+    else
+    {
+      readSas([&](const SasSpan& frame)
+      {
         /*
          * This part is a "legacy" method. It have been implemented in perl time ago
          * and needs refactoring. The main problem is math related, because we have to
@@ -676,97 +853,36 @@ namespace PstpFinder
          * -- Edoardo Morandi
          */
 
-        if(counter % timeStep == 0)
-          std::fill(std::begin(sasCounters), std::end(sasCounters), 0.);
-
-        std::transform(std::begin(sasAtoms), std::end(sasAtoms),
-            std::begin(sas), std::begin(sas),
-            [](const SasAtom& a, float){return a.sas;});
-
-        std::transform(std::begin(sasCounters), std::end(sasCounters),
-            std::begin(sas), std::begin(sasCounters), std::plus<float>());
-
-        if((counter + 1) % timeStep == 0)
+        const unsigned int bin = counter * stride / timeStep;
+        if(binSamples > 0 and bin != currentBin)
         {
-          for(auto& sasCounter : sasCounters)
-            sasCounter /= timeStep;
-
-          if(abortFlag) return;
-
-          for(Group& group : groups)
-          {
-            if(abortFlag) return;
-            group.sas.push_back(0);
-            float& curFrame = group.sas.back();
-
-            if(sasCounters[group.getCentralH().index - 1] < 0.000001)
-            {
-              group.zeros++;
-              continue;
-            }
-
-            const vector<const Residue<SasPdbAtom>*>& residues = group.getResidues();
-            for(const Residue<SasPdbAtom>* const& residuePtr : residues)
-            {
-              if(abortFlag) return;
-              const SasPdbAtom& atomH = residuePtr->getAtomByType("H");
-              if(atomH.getTrimmedAtomType() == "UNK")
-                continue;
-
-              if(meanSas[atomH.index - 1] != 0)
-                curFrame += sasCounters[atomH.index - 1]
-                            / meanSas[atomH.index - 1];
-            }
+          if(not pushBin(bin - currentBin))
+            return false;
+          binSamples = 0;
+        }
 
-            curFrame /= group.getResidues().size();
+        if(binSamples == 0)
+          std::fill(std::begin(sasCounters), std::end(sasCounters), 0.);
+        currentBin = bin;
 
-            if(curFrame < 0.000001)
-              group.zeros++;
-
-          }
-        }
+        for(int i = 0; i < nAtoms; i++)
+          sasCounters[i] += frame[i];
+        binSamples++;
 
         counter++;
-        setStatus(static_cast<float>(counter) / gromacs.getFramesCount());
-      }
+        setStatus(static_cast<float>(counter) * stride / frames);
+        return true;
+      });
     }
+    if(abortFlag) return;
 
-    if(counter % timeStep != 0)
+    if(binSamples > 0)
     {
-      for(auto& sasCounter : sasCounters)
-        sasCounter /= (counter % timeStep);
-
-      if(abortFlag) return;
-
-      for(Group& group : groups)
-      {
-        if(abortFlag) return;
-        group.sas.push_back(0);
-        float& curFrame = group.sas.back();
-
-        if(sasCounters[group.getCentralH().index - 1] < 0.000001)
-        {
-          group.zeros++;
-          continue;
-        }
-
-        const vector<const Residue<SasPdbAtom>*>& residues = group.getResidues();
-        for(const Residue<SasPdbAtom>* const& residuePtr : residues)
-        {
-          if(abortFlag) return;
-          const SasPdbAtom& atomH = residuePtr->getAtomByType("H");
-          if(atomH.getTrimmedAtomType() == "UNK")
-            continue;
-
-          if(meanSas[atomH.index - 1] != 0)
-            curFrame += sasCounters[atomH.index - 1] / meanSas[atomH.index - 1];
-        }
-
-        curFrame /= group.getResidues().size();
-
-        if(curFrame < 0.000001)
-          group.zeros++;
-      }
+      // The last sample stands for stride frames, unless the trajectory ends
+      const unsigned int lastFrame = std::min(counter * stride,
+                                              static_cast<unsigned int>(frames))
+                                     - 1;
+      pushBin(std::max(lastFrame / timeStep, currentBin) - currentBin + 1);
     }
   }
 
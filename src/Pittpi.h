@@ -28,6 +28,9 @@
 #include <vector>
 #include <thread>
 
+// Width in ps of the bins SAS is averaged on
+#define PS_PER_SAS 5
+
 namespace PstpFinder
 {
   class Group
@@ -34,16 +34,35 @@ namespace PstpFinder
 #include "SasAnalysisThread.h"
 #include "utils.h"
 #include "Serializer.h"
+#include "FramePool.h"
+#include "SasCodec.h"
+#include "SpscRing.h"
+#include "MemoryBudget.h"
+#include "SasChunkIndex.h"
+#include "AverageState.h"
 
 #include <thread>
-#include <sys/sysinfo.h>
-#include <boost/circular_buffer.hpp>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
 
 #include <vector>
 #include <string>
 #include <iostream>
 #include <sstream>
 #include <type_traits>
+#include <unistd.h>
+
+// Chunks are sized to hold about this much time of analysis
+#define SAS_CHUNK_SECONDS 2
+// Most chunks buffered at once, whatever the budget
+#define SAS_MAX_CHUNKS 64
+// Saved chunks between checkpoints of the chunk index
+#define SAS_CHECKPOINT_CHUNKS 16
+// SAS frames between checkpoints of the average structure
+#define SAS_AVERAGE_CHECKPOINT_FRAMES 256
 
 namespace PstpFinder
 {
@@ -58,25 +77,43 @@ namespace PstpFinder
       SasAnalysis_Base(const Gromacs& gromacs,
                        const std::string& sessionFileName);
       SasAnalysis_Base(const Gromacs&, Session<T>&);
+      virtual ~SasAnalysis_Base();
+
+      /*
+       * Unless they are set here, both follow the share of the process
+       * MemoryBudget of this analysis while it runs.
+       */
       virtual bool setMaxBytes(unsigned long bytes);
       virtual unsigned long getMaxBytes();
       virtual bool setMaxChunkSize(unsigned long bytes);
       virtual unsigned long getMaxChunkSize();
 
     protected:
-      boost::circular_buffer<std::vector<SasAtom*>> chunks;
       std::vector<SasAtom*> frames;
+      // Every frame above comes from here and goes back when done with
+      FramePool<SasAtom> framePool;
       unsigned int nAtoms;
       Session<T> rawSession;
       MetaStream<T>& sasMetaStream;
+      std::string sessionFileName;
+      // Where the SAS stream starts in the session file
+      unsigned long sasOffset;
+      // Only the SAS of every atom is stored (see Session::isSasCompact())
+      bool compact;
+      // Compact chunks are compressed when the precision is not zero
+      real precision;
+      mutable SasCodec codec;
+      mutable std::vector<unsigned char> codecData;
+      // SAS of a whole compact chunk, read or written at once
+      mutable std::vector<real> sasData;
+      // Values of uncompressed chunks are aligned (see Session)
+      bool aligned;
       Serializer<MetaStream<T>>* serializer;
       std::streampos fileStreamEnd;
       const Gromacs* gromacs;
       unsigned long maxFrames, maxBytes, maxChunk;
-      unsigned int bufferCount;
       unsigned int bufferMax;
-      mutable std::condition_variable bufferCountCondition;
-      mutable std::mutex bufferMutex, bufferCountMutex;
+      bool fixedBytes, fixedChunk;
       bool changeable;
 
       template<typename, typename> friend class SasAnalysisThread_Base;
@@ -86,6 +123,9 @@ namespace PstpFinder
 
       virtual void init();
       virtual void updateChunks();
+      void updateBudget();
+      unsigned long chunkBytes(unsigned long frames) const;
+      static std::streamoff chunkPadding(std::streamoff position);
   };
 
   template<typename T>
@@ -95,23 +135,64 @@ namespace PstpFinder
       typedef SasAnalysisThread<T> SasAnalysisThreadType;
       SasAnalysis_Read(unsigned int nAtoms, const Gromacs& gromacs,
                         Session<T>& sessionFile) :
-          Base(nAtoms, gromacs, sessionFile) { updateChunks(); }
+          Base(nAtoms, gromacs, sessionFile) { initLoading(); }
       SasAnalysis_Read(const Gromacs& gromacs,
                        const std::string& sessionFileName) :
-          Base(gromacs, sessionFileName) { updateChunks(); }
+          Base(gromacs, sessionFileName) { initLoading(); }
       SasAnalysis_Read(const Gromacs& gromacs, Session<T>& sessionFile) :
-          Base(gromacs, sessionFile) { updateChunks(); }
+          Base(gromacs, sessionFile) { initLoading(); }
       virtual ~SasAnalysis_Read();
       virtual bool read(std::vector<SasAtom>& sasAtom);
 
+      /**
+       * @brief Reads the frames left in the current chunk, without copying
+       *
+       * Frames stay valid until the next read.
+       */
+      virtual bool read(std::vector<const SasAtom*>& sasFrames);
+
+      /**
+       * @brief Number of threads decoding chunks, before the first read
+       */
+      virtual bool setDecodeThreads(unsigned int threads);
+      virtual unsigned int getDecodeThreads();
+
     private:
       typedef SasAnalysis_Base<T> Base;
       template<typename, typename> friend class SasAnalysisThread_Base;
       template<typename, typename> friend class SasAnalysisThread;
 
-      virtual std::vector<SasAtom*>
-        loadChunk(Serializer<MetaStream<T>>& in);
-      bool open();
+      // What every decoding thread keeps between chunks
+      struct Decoder
+      {
+        SasCodec codec;
+        std::vector<unsigned char> codecData;
+        std::vector<real> sasData;
+      };
+
+      // Chunk n goes to slot n % slots.size(), until it is handed out
+      struct LoadedChunk
+      {
+        std::vector<SasAtom*> frames;
+        bool ready;
+      };
+
+      std::vector<LoadedChunk> slots;
+      // Chunks claimed by the decoders and handed out to read()
+      unsigned long nextLoad, nextRead;
+      // No more chunks are claimed, at the end of the stream or when stopped
+      bool loadEnded;
+      std::mutex loadMutex;
+      std::condition_variable loadCondition;
+      unsigned int decodeThreads;
+      // Next frame of Base::frames given by read()
+      std::size_t currentFrame;
+
+      void initLoading();
+      bool nextChunk();
+      bool open(Decoder& decoder);
+      void stopLoading();
+      unsigned int loadLimit() const;
       virtual void updateChunks();
   };
 
@@ -123,28 +204,87 @@ namespace PstpFinder
       typedef SasAnalysisThread<T> SasAnalysisThreadType;
       SasAnalysis_Write(unsigned int nAtoms, const Gromacs& gromacs,
                         Session<T>& sessionFile) :
-          Base(nAtoms, gromacs, sessionFile), readFrames(0) { updateChunks(); }
+          Base(nAtoms, gromacs, sessionFile), readFrames(0),
+          savedFrames(0), checkpointChunks(SAS_CHECKPOINT_CHUNKS),
+          syncPolicy(SasChunkIndex::SyncPolicy::CHECKPOINTS),
+          chunkStart(std::chrono::steady_clock::now())
+          { updateChunks(); }
       SasAnalysis_Write(const Gromacs& gromacs,
                         const std::string& sessionFileName) :
-          Base(gromacs, sessionFileName), readFrames(0) { updateChunks(); }
+          Base(gromacs, sessionFileName), readFrames(0),
+          savedFrames(0), checkpointChunks(SAS_CHECKPOINT_CHUNKS),
+          syncPolicy(SasChunkIndex::SyncPolicy::CHECKPOINTS),
+          chunkStart(std::chrono::steady_clock::now())
+          { updateChunks(); }
       SasAnalysis_Write(const Gromacs& gromacs, Session<T>& sessionFile) :
-          Base(gromacs, sessionFile), readFrames(0) { updateChunks(); }
+          Base(gromacs, sessionFile), readFrames(0),
+          savedFrames(0), checkpointChunks(SAS_CHECKPOINT_CHUNKS),
+          syncPolicy(SasChunkIndex::SyncPolicy::CHECKPOINTS),
+          chunkStart(std::chrono::steady_clock::now())
+          { updateChunks(); }
       virtual ~SasAnalysis_Write();
       virtual void write(const std::vector<SasAtom>& sasAtoms);
+
+      /**
+       * @brief Writes, and takes, a frame of getFramePool() without copies
+       */
+      virtual void write(SasAtom* frame);
+
+      /**
+       * @brief Pool of frames of nAtoms atoms, to be filled and written
+       */
+      FramePool<SasAtom>& getFramePool();
       unsigned int getReadFrames() const;
 
+      /**
+       * @brief Saved chunks between checkpoints, zero for none at all
+       */
+      void setCheckpointChunks(unsigned int chunks);
+      unsigned int getCheckpointChunks() const;
+
+      /**
+       * @brief Whether checkpoints, never single chunks, wait for the disk
+       */
+      void setSyncPolicy(SasChunkIndex::SyncPolicy policy);
+      SasChunkIndex::SyncPolicy getSyncPolicy() const;
+
+      /**
+       * @brief Average of the first SAS frames, saved once their SAS is
+       */
+      void addAverageCheckpoint(AverageCheckpoint&& checkpoint);
+
     protected:
       unsigned int readFrames;
+      // Saved chunks are added here by the writer thread, once started
+      SasChunkIndex chunkIndex;
+      unsigned long savedFrames;
+      // Read by the writer thread, they can be changed at any time
+      std::atomic<unsigned int> checkpointChunks;
+      std::atomic<SasChunkIndex::SyncPolicy> syncPolicy;
+      // Only the oldest and the newest are kept, so one is saved sooner
+      std::vector<AverageCheckpoint> averageCheckpoints;
+      std::mutex averageMutex;
 
     private:
       typedef SasAnalysis_Base<T> Base;
+      /*
+       * Full chunks go to the writer thread through here, frames is the
+       * chunk being filled. Slots are swapped with frames, so they keep
+       * their capacity.
+       */
+      std::unique_ptr<SpscRing<std::vector<SasAtom*>>> ring;
+      // When the previous chunk was flushed
+      std::chrono::steady_clock::time_point chunkStart;
       template<typename, typename> friend class SasAnalysisThread_Base;
       template<typename, typename> friend class SasAnalysisThread;
 
       virtual void dumpChunk(const std::vector<SasAtom*>& chunk,
                 Serializer<MetaStream<T>>& out) const;
       virtual void flush();
+      void adaptChunks();
       virtual bool save();
+      void checkpoint();
+      void saveAverageCheckpoint();
       virtual void updateChunks();
   };
 
@@ -208,43 +348,125 @@ namespace PstpFinder
       void
       init()
       {
-          size_t sasAtomSize(Base::serializer->getSerializedSize(SasAtom()));
+          size_t sasAtomSize(Base::compact ?
+                             Base::serializer->getSerializedSize(real()) :
+                             Base::serializer->getSerializedSize(SasAtom()));
           Base::sasMetaStream.seekg(0);
           Base::changeable = false;
           Base::serializer = new Serializer<MetaStream<T>>(Base::sasMetaStream);
 
-          unsigned int validatedChunks(0);
           unsigned int chunkSize;
+          std::streamoff chunkBytes;
           unsigned long totalFrames(0);
-          std::streampos backupPosition;
+          std::streamoff chunkOffset(0);
 
-          *Base::serializer >> chunkSize;
-          backupPosition = Base::sasMetaStream.tellg();
+          Base::sasMetaStream.seekg(0, std::ios_base::end);
+          const std::streamoff streamBytes = Base::sasMetaStream.tellg();
 
-          while(not Base::sasMetaStream.eof())
+          // Compressed chunks store their size after the number of frames
+          auto readChunkHeader = [&]()
           {
-            Base::sasMetaStream.seekg(chunkSize * sasAtomSize * Base::nAtoms,
-                                      std::ios_base::cur);
+            *Base::serializer >> chunkSize;
+            if(Base::codec.getPrecision() > 0)
+            {
+              unsigned int encodedBytes;
+              *Base::serializer >> encodedBytes;
+              chunkBytes = encodedBytes;
+            }
+            else
+            {
+              chunkBytes = static_cast<std::streamoff>(chunkSize)
+                           * sasAtomSize * Base::nAtoms;
+              if(Base::aligned)
+                chunkBytes += Base::chunkPadding(Base::sasMetaStream.tellg());
+            }
+          };
 
-            if(Base::sasMetaStream.eof())
+          /*
+           * Seeking past the end of the stream is not an error, so a chunk
+           * cut by a crash is told by its end, not by reaching it.
+           */
+          auto isWhole = [&](std::streamoff offset)
+          {
+            Base::sasMetaStream.clear();
+            Base::sasMetaStream.seekg(offset);
+            readChunkHeader();
+            return not Base::sasMetaStream.eof()
+                   and not Base::sasMetaStream.fail() and chunkSize > 0
+                   and Base::sasMetaStream.tellg() + chunkBytes
+                       <= streamBytes;
+          };
+
+          // An indexed chunk must be still there, whole
+          auto isStored = [&](const SasChunkIndex::Entry& entry)
+          {
+            return isWhole(entry.offset) and chunkSize == entry.frames
+                   and Base::sasMetaStream.tellg() + chunkBytes
+                       == static_cast<std::streamoff>(entry.endOffset());
+          };
+
+          /*
+           * Usually the index tells where the last chunk ends, and only the
+           * stream after it is walked, looking for chunks that were saved
+           * but not indexed. Without an index the whole stream is walked,
+           * and the index is built along the way. Chunks up to the last
+           * checkpoint are not even checked, as long as the stream still
+           * reaches where the checkpoint says.
+           */
+          if(Base::chunkIndex.open(Base::sessionFileName, Base::sasOffset))
+          {
+            const SasChunkIndex::Checkpoint& checkpoint =
+                Base::chunkIndex.getCheckpoint();
+            std::size_t checked = 0;
+            if(checkpoint.chunks > 0
+               and Base::chunkIndex[checkpoint.chunks - 1].endOffset()
+                   == checkpoint.sasBytes
+               and checkpoint.sasBytes
+                   <= static_cast<std::uint64_t>(streamBytes))
+              checked = checkpoint.chunks;
+
+            std::size_t chunks = Base::chunkIndex.size();
+            while(chunks > checked
+                  and not isStored(Base::chunkIndex[chunks - 1]))
+              chunks--;
+            Base::chunkIndex.truncate(chunks);
+
+            if(chunks > 0)
             {
-              Base::sasMetaStream.seekg(backupPosition);
-              break;
+              chunkOffset = Base::chunkIndex[chunks - 1].endOffset();
+              totalFrames = Base::chunkIndex[chunks - 1].endFrame();
             }
+          }
+          else
+            Base::chunkIndex.create(Base::sessionFileName, Base::sasOffset);
 
+          while(isWhole(chunkOffset))
+          {
+            const std::streamoff chunkEnd = Base::sasMetaStream.tellg()
+                                            + chunkBytes;
+            Base::chunkIndex.append({ totalFrames,
+                                      static_cast<std::uint64_t>(chunkOffset),
+                                      static_cast<std::uint64_t>(
+                                          chunkEnd - chunkOffset),
+                                      chunkSize });
             totalFrames += chunkSize;
-            validatedChunks++;
-            backupPosition = Base::sasMetaStream.tellg();
-            *Base::serializer >> chunkSize;
+            chunkOffset = chunkEnd;
           }
 
+          /*
+           * A chunk cut by a crash is dropped, and new chunks are saved in
+           * its place. Nothing comes after the SAS stream of a session that
+           * is not complete, so the file is cut there.
+           */
           Base::sasMetaStream.clear();
-          if(totalFrames == 0)
-            Base::sasMetaStream.seekg(0);
-          else
-            Base::sasMetaStream.seekg(0, std::ios_base::end);
+          if(chunkOffset < streamBytes and
+             ::truncate(Base::sessionFileName.c_str(),
+                        Base::sasOffset + chunkOffset) == 0)
+            Base::sasMetaStream.setSize(chunkOffset);
+          Base::sasMetaStream.seekg(chunkOffset);
 
           Base::readFrames = totalFrames;
+          Base::savedFrames = totalFrames;
           Base::sasMetaStream.seekp(Base::sasMetaStream.tellg());
           Base::analysisThread = new SasAnalysisThread<T>(*this);
       }
@@ -258,6 +480,11 @@ namespace PstpFinder
   {
     this->nAtoms = nAtoms;
     this->gromacs = &gromacs;
+    sessionFileName = session.getFileName();
+    sasOffset = session.getSasOffset();
+    compact = session.isSasCompact();
+    precision = session.getSasPrecision();
+    aligned = session.isSasAligned();
     init();
   }
 
@@ -268,6 +495,11 @@ namespace PstpFinder
   {
     nAtoms = gromacs.getGroup("Protein").size();
     this->gromacs = &gromacs;
+    sessionFileName = session.getFileName();
+    sasOffset = session.getSasOffset();
+    compact = session.isSasCompact();
+    precision = session.getSasPrecision();
+    aligned = session.isSasAligned();
     init();
   }
 
@@ -278,6 +510,11 @@ namespace PstpFinder
   {
     nAtoms = gromacs.getGroup("Protein").size();
     this->gromacs = &gromacs;
+    this->sessionFileName = sessionFileName;
+    sasOffset = rawSession.getSasOffset();
+    compact = rawSession.isSasCompact();
+    precision = rawSession.getSasPrecision();
+    aligned = rawSession.isSasAligned();
     init();
   }
 
@@ -286,18 +523,51 @@ namespace PstpFinder
   SasAnalysis_Base<T>::init()
   {
     changeable = true;
+    framePool.setFrameSize(nAtoms);
+    codec = SasCodec(nAtoms, compact ? precision : 0);
 
-    struct sysinfo info;
-    if(sysinfo(&info) == 0)
+    MemoryBudget::instance().attach();
+    fixedBytes = false;
+    fixedChunk = false;
+    maxChunk = 8388608;
+    updateBudget();
+  }
+
+  template<typename T>
+  SasAnalysis_Base<T>::~SasAnalysis_Base()
+  {
+    MemoryBudget::instance().detach();
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Base<T>::updateBudget()
+  {
+    if(not fixedBytes)
     {
-      maxBytes = info.freeram * 0.8; // 80% of free ram
-      if(maxBytes > 1073741824) // 1 GB
-        maxBytes = 1073741824;
+      // Two chunks of a frame at least, one filled and one saved
+      maxBytes = std::max(MemoryBudget::instance().share(),
+                          chunkBytes(1) * 2);
     }
-    else
-      maxBytes = 134217728;
 
-    maxChunk = 8388608;
+    if(not fixedChunk)
+      maxChunk = std::min(maxChunk, maxBytes / 2);
+  }
+
+  template<typename T>
+  unsigned long
+  SasAnalysis_Base<T>::chunkBytes(unsigned long frames) const
+  {
+    // Chunks are in memory as SasAtom (real * 4), whatever is stored
+    return frames * (sizeof(SasAtom*) + sizeof(SasAtom) * nAtoms)
+           + sizeof(std::vector<SasAtom*>);
+  }
+
+  template<typename T>
+  std::streamoff
+  SasAnalysis_Base<T>::chunkPadding(std::streamoff position)
+  {
+    return (sizeof(real) - position % sizeof(real)) % sizeof(real);
   }
 
   template<typename T>
@@ -310,7 +580,10 @@ namespace PstpFinder
     delete Base::analysisThread;
 
     for(auto& frame : Base::frames)
-      delete[] frame;
+      Base::framePool.release(frame);
+    for(LoadedChunk& slot : slots)
+      for(SasAtom* frame : slot.frames)
+        Base::framePool.release(frame);
 
     delete Base::serializer;
   }
@@ -324,31 +597,17 @@ namespace PstpFinder
     /* Do not save the last chunk if we are aborting! */
     if(not Base::gromacs or Base::gromacs->isAborting())
     {
-      Base::bufferMutex.lock();
+      for(SasAtom* frame : Base::frames)
+        Base::framePool.release(frame);
       Base::frames.clear();
-      Base::bufferMutex.unlock();
     }
     else if(Base::frames.size() != 0)
       flush();
 
-    Base::bufferMutex.lock();
-    while(Base::bufferCount != Base::bufferMax - 1)
-    {
-      std::unique_lock<std::mutex> bufferCountLock(Base::bufferCountMutex);
-      Base::bufferMutex.unlock();
-      Base::bufferCountCondition.wait(bufferCountLock);
-      Base::bufferMutex.lock();
-    }
-    Base::bufferMutex.unlock();
-
+    ring->waitEmpty();
     Base::analysisThread->stop();
     delete Base::analysisThread;
-
-    for(auto& chunk : Base::chunks)
-    {
-      for(auto& frame : chunk)
-        delete[] frame;
-    }
+    saveAverageCheckpoint();
 
     delete Base::serializer;
     Base::sasMetaStream.close();
@@ -359,97 +618,145 @@ namespace PstpFinder
   SasAnalysis_Write<T>::write(const std::vector<SasAtom>& sasAtoms)
   {
     assert(sasAtoms.size() == Base::nAtoms);
-    SasAtom* tmpFrame = new SasAtom[Base::nAtoms];
+    SasAtom* tmpFrame = Base::framePool.acquire();
+    std::copy(std::begin(sasAtoms), std::end(sasAtoms), tmpFrame);
+    write(tmpFrame);
+  }
+
+  template<typename T>
+  FramePool<SasAtom>&
+  SasAnalysis_Write<T>::getFramePool()
+  {
+    return Base::framePool;
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::write(SasAtom* frame)
+  {
     if(Base::changeable)
     {
       Base::changeable = false;
       Base::serializer = new Serializer<MetaStream<T>>(Base::sasMetaStream);
+      chunkIndex.create(Base::sessionFileName, Base::sasOffset);
+      AverageCheckpoint::remove(Base::sessionFileName);
 
       Base::analysisThread = new SasAnalysisThreadType(*this);
     }
 
-    std::copy(std::begin(sasAtoms), std::end(sasAtoms), tmpFrame);
-    Base::bufferMutex.lock();
-    Base::frames.push_back(tmpFrame);
-
-    bool cond = (Base::frames.size() == Base::maxFrames);
-    Base::bufferMutex.unlock();
+    // Only this thread touches frames, the writer gets whole chunks
+    if(Base::frames.capacity() < Base::maxFrames)
+      Base::frames.reserve(Base::maxFrames);
+    Base::frames.push_back(frame);
 
-    if(cond)
+    if(Base::frames.size() >= Base::maxFrames)
       flush();
   }
 
+  template<typename T>
+  void
+  SasAnalysis_Read<T>::initLoading()
+  {
+    nextLoad = 0;
+    nextRead = 0;
+    loadEnded = false;
+    currentFrame = 0;
+    decodeThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    updateChunks();
+  }
+
   template<typename T>
   bool
   SasAnalysis_Read<T>::read(std::vector<SasAtom>& sasAtom)
   {
-    static std::vector<SasAtom*>::const_iterator currentFrameIter;
+    while(currentFrame == Base::frames.size())
+    {
+      if(not nextChunk())
+      {
+        sasAtom.clear();
+        return false;
+      }
+    }
 
-    if(Base::changeable)
+    if(sasAtom.size() != Base::nAtoms)
     {
-      Base::changeable = false;
-      Base::serializer = new Serializer<MetaStream<T>>(Base::sasMetaStream);
+      sasAtom.clear();
+      sasAtom.resize(Base::nAtoms);
+    } 
+    std::copy_n(Base::frames[currentFrame], Base::nAtoms, std::begin(sasAtom));
+    ++currentFrame;
 
-      Base::analysisThread = new SasAnalysisThreadType(*this);
-    }
+    return true;
+  }
 
-    if(Base::frames.size() == 0)
+  template<typename T>
+  bool
+  SasAnalysis_Read<T>::read(std::vector<const SasAtom*>& sasFrames)
+  {
+    while(currentFrame == Base::frames.size())
     {
-      Base::bufferMutex.lock();
-      while(Base::bufferCount == 0)
+      if(not nextChunk())
       {
-        std::unique_lock<std::mutex> bufferCountLock(Base::bufferCountMutex);
-        Base::bufferMutex.unlock();
-        Base::bufferCountCondition.wait(bufferCountLock);
-        Base::bufferMutex.lock();
+        sasFrames.clear();
+        return false;
       }
-      Base::frames = Base::chunks.front();
-      currentFrameIter = Base::frames.begin();
-
-      Base::bufferCount--;
-      Base::bufferMutex.unlock();
     }
-    else if(currentFrameIter == Base::frames.end())
-    {
-      Base::bufferMutex.lock();
 
-      for(SasAtom* frame : Base::frames)
-        delete[] frame;
-      Base::frames.clear();
+    sasFrames.assign(Base::frames.begin() + currentFrame, Base::frames.end());
+    currentFrame = Base::frames.size();
 
-      Base::chunks.pop_front();
+    return true;
+  }
 
-      if(Base::bufferCount == 0)
-      {
-        Base::bufferMutex.unlock();
-        std::unique_lock<std::mutex> bufferCountLock(Base::bufferCountMutex);
-        Base::bufferCountCondition.wait(bufferCountLock);
-        Base::bufferMutex.lock();
-      }
+  template<typename T>
+  bool
+  SasAnalysis_Read<T>::setDecodeThreads(unsigned int threads)
+  {
+    if(not Base::changeable or threads == 0)
+      return false;
 
-      Base::bufferCount--;
+    decodeThreads = threads;
+    return true;
+  }
 
-      if(Base::chunks.size() == 0)
-      {
-        Base::bufferMutex.unlock();
-        sasAtom.clear();
-        return false;
-      }
+  template<typename T>
+  unsigned int
+  SasAnalysis_Read<T>::getDecodeThreads()
+  {
+    return decodeThreads;
+  }
 
-      Base::frames = Base::chunks.front();
-      currentFrameIter = Base::frames.begin();
+  template<typename T>
+  bool
+  SasAnalysis_Read<T>::nextChunk()
+  {
+    if(Base::changeable)
+    {
+      Base::changeable = false;
+      Base::serializer = new Serializer<MetaStream<T>>(Base::sasMetaStream);
 
-      Base::analysisThread->wakeUp();
-      Base::bufferMutex.unlock();
+      Base::analysisThread = new SasAnalysisThreadType(*this);
     }
 
-    if(sasAtom.size() != Base::nAtoms)
+    for(SasAtom* frame : Base::frames)
+      Base::framePool.release(frame);
+    Base::frames.clear();
+    currentFrame = 0;
+
+    std::unique_lock<std::mutex> lock(loadMutex);
+    LoadedChunk& slot = slots[nextRead % slots.size()];
+    loadCondition.wait(lock, [&]()
     {
-      sasAtom.clear();
-      sasAtom.resize(Base::nAtoms);
-    } 
-    std::copy_n(*currentFrameIter, Base::nAtoms, std::begin(sasAtom));
-    ++currentFrameIter;
+      return slot.ready or (loadEnded and nextRead == nextLoad);
+    });
+    if(not slot.ready)
+      return false;
+
+    // The slot keeps the capacity of the previous chunk
+    std::swap(Base::frames, slot.frames);
+    slot.ready = false;
+    nextRead++;
+    loadCondition.notify_all();
 
     return true;
   }
@@ -462,69 +769,231 @@ namespace PstpFinder
     {
       Base::changeable = false;
       Base::serializer = new Serializer<MetaStream<T>>(Base::sasMetaStream);
+      chunkIndex.create(Base::sessionFileName, Base::sasOffset);
+      AverageCheckpoint::remove(Base::sessionFileName);
 
       Base::analysisThread = new SasAnalysisThreadType(*this);
     }
 
-    Base::bufferMutex.lock();
-    while(Base::bufferCount == 0)
-    {
-      std::unique_lock<std::mutex> bufferCountLock(Base::bufferCountMutex);
-      Base::bufferMutex.unlock();
-      Base::bufferCountCondition.wait(bufferCountLock);
-      Base::bufferMutex.lock();
-    }
-    Base::bufferCount--;
-    Base::chunks.push_back(Base::frames);
+    adaptChunks();
 
-    Base::frames.clear();
-    Base::analysisThread->wakeUp();
-    Base::bufferMutex.unlock();
+    // Waits only when every slot is still waiting to be saved
+    if(not ring->waitNotFull())
+      return;
+
+    std::swap(ring->back(), Base::frames);
+    ring->push();
   }
 
   template<typename T>
   bool
   SasAnalysis_Write<T>::save()
   {
-    if(Base::chunks.empty())
+    if(ring->empty())
       return false;
 
-    dumpChunk(Base::chunks.front(), *Base::serializer);
+    // The producer does not touch the front slot, no lock is needed
+    std::vector<SasAtom*>& chunk = ring->front();
+    const std::streamoff chunkOffset = Base::sasMetaStream.tellp();
+    SasAnalysis_Write::dumpChunk(chunk, *Base::serializer);
+
+    // The entry follows the chunk, it is checked when resuming anyway
+    if(not Base::gromacs or not Base::gromacs->isAborting())
+    {
+      const std::streamoff chunkEnd = Base::sasMetaStream.tellp();
+      chunkIndex.append({ savedFrames,
+                          static_cast<std::uint64_t>(chunkOffset),
+                          static_cast<std::uint64_t>(chunkEnd - chunkOffset),
+                          static_cast<std::uint32_t>(chunk.size()) });
+      savedFrames += chunk.size();
+
+      const unsigned int chunks = checkpointChunks;
+      if(chunks > 0 and chunkIndex.size()
+                        >= chunkIndex.getCheckpoint().chunks + chunks)
+        SasAnalysis_Write::checkpoint();
+    }
+    for(SasAtom* frame : chunk)
+      Base::framePool.release(frame);
+    chunk.clear();
+    ring->pop();
 
     return true;
   }
 
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::checkpoint()
+  {
+    // The stream is flushed, the index takes care of syncing
+    Base::sasMetaStream.flush();
+    chunkIndex.checkpoint(Base::sasMetaStream.tellp(), syncPolicy);
+    saveAverageCheckpoint();
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::saveAverageCheckpoint()
+  {
+    // The newest one whose SAS is saved, a resumed analysis starts after it
+    std::lock_guard<std::mutex> lock(averageMutex);
+    auto saved = std::end(averageCheckpoints);
+    for(auto i = std::begin(averageCheckpoints);
+        i != std::end(averageCheckpoints); i++)
+      if(i->getSasFrames() <= savedFrames)
+        saved = i;
+
+    if(saved == std::end(averageCheckpoints))
+      return;
+
+    saved->save(Base::sessionFileName, Base::sasOffset);
+    averageCheckpoints.erase(std::begin(averageCheckpoints), saved + 1);
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::addAverageCheckpoint(AverageCheckpoint&& checkpoint)
+  {
+    std::lock_guard<std::mutex> lock(averageMutex);
+    if(averageCheckpoints.size() > 1)
+      averageCheckpoints.pop_back();
+    averageCheckpoints.push_back(std::move(checkpoint));
+  }
+
   template<typename T>
   bool
-  SasAnalysis_Read<T>::open()
+  SasAnalysis_Read<T>::open(Decoder& decoder)
   {
+    std::unique_lock<std::mutex> lock(loadMutex);
+    loadCondition.wait(lock, [this]()
+    {
+      return loadEnded or nextLoad - nextRead < loadLimit();
+    });
+    if(loadEnded)
+      return false;
+
     Base::sasMetaStream.peek();
-    if(Base::sasMetaStream.eof())
+    if(Base::sasMetaStream.eof()
+       or (Base::gromacs and Base::gromacs->isAborting()))
+    {
+      loadEnded = true;
+      loadCondition.notify_all();
       return false;
+    }
+
+    // The raw chunk is read here, in file order, and decoded unlocked
+    const unsigned long sequence = nextLoad++;
+    Serializer<MetaStream<T>>& in = *Base::serializer;
+    unsigned int size;
+    std::vector<SasAtom*> chunk;
+    // Frames from here on could not be read
+    unsigned int validFrames;
 
-    std::vector<SasAtom*> chunk = loadChunk(*Base::serializer);
-    unsigned long chunkSize = chunk.capacity()
-                              * (sizeof(SasAtom*)
-                                 + sizeof(SasAtom) * Base::nAtoms)
-                              + sizeof(std::vector<SasAtom*> );
-    if(chunkSize > Base::maxChunk)
+    in >> size;
+    // Chunks are as big as they were stored, how many follows the budget
+    Base::updateBudget();
+    Base::maxChunk = Base::chunkBytes(size);
+    Base::updateChunks();
+
+    chunk.reserve(size);
+    for(unsigned int i = 0; i < size; i++)
+      chunk.push_back(Base::framePool.acquire());
+
+    if(decoder.codec.getPrecision() > 0)
     {
-      // bufferMutex already lock_upgrade from ThreadOpen
-      while(Base::bufferCount != 0)
+      unsigned int encodedBytes;
+      in >> encodedBytes;
+      decoder.codecData.resize(encodedBytes);
+      validFrames = in.readArray(decoder.codecData.data(), encodedBytes) ?
+                    size : 0;
+    }
+    else if(Base::compact)
+    {
+      if(Base::aligned)
+        Base::sasMetaStream.seekg(
+            Base::chunkPadding(Base::sasMetaStream.tellg()),
+            std::ios_base::cur);
+
+      decoder.sasData.resize(static_cast<std::size_t>(size) * Base::nAtoms);
+      validFrames = in.readArray(decoder.sasData.data(),
+                                 decoder.sasData.size()) ? size : 0;
+    }
+    else
+    {
+      if(Base::aligned)
+        Base::sasMetaStream.seekg(
+            Base::chunkPadding(Base::sasMetaStream.tellg()),
+            std::ios_base::cur);
+
+      // Nothing to decode, frames are read in place
+      for(validFrames = 0; validFrames < size; validFrames++)
       {
-        std::unique_lock<std::mutex> lock(Base::bufferCountMutex);
-        Base::bufferMutex.unlock();
-        Base::bufferCountCondition.wait(lock);
-        Base::bufferMutex.lock();
+        if(not in.readArray(reinterpret_cast<real*>(chunk[validFrames]),
+                            Base::nAtoms * 4))
+          break;
       }
-      Base::maxChunk = chunkSize;
-      updateChunks();
     }
-    Base::chunks.push_back(chunk);
+    lock.unlock();
+
+    if(decoder.codec.getPrecision() > 0)
+    {
+      decoder.sasData.resize(static_cast<std::size_t>(size) * Base::nAtoms);
+      if(validFrames > 0
+         and not decoder.codec.decode(decoder.codecData.data(),
+                                      decoder.codecData.size(),
+                                      decoder.sasData.data(), size))
+        validFrames = 0;
+    }
+
+    if(Base::compact and validFrames > 0)
+    {
+      // Coordinates are not stored, they are left empty
+      const real* sas = decoder.sasData.data();
+      for(SasAtom* frame : chunk)
+      {
+        SasAtom* end = frame + Base::nAtoms;
+        for(SasAtom* atom = frame; atom < end; ++atom)
+        {
+          *atom = SasAtom();
+          atom->sas = *sas++;
+        }
+      }
+    }
+
+    if(validFrames < size)
+    {
+      std::cerr << "Warning: inconsistent binary file." << std::endl;
+      // Frames have a fixed size, missing ones are left empty
+      for(unsigned int i = validFrames; i < size; i++)
+        std::fill(chunk[i], chunk[i] + Base::nAtoms, SasAtom());
+    }
+
+    lock.lock();
+    LoadedChunk& slot = slots[sequence % slots.size()];
+    std::swap(slot.frames, chunk);
+    slot.ready = true;
+    loadCondition.notify_all();
 
     return true;
   }
 
+  template<typename T>
+  void
+  SasAnalysis_Read<T>::stopLoading()
+  {
+    std::lock_guard<std::mutex> lock(loadMutex);
+    loadEnded = true;
+    loadCondition.notify_all();
+  }
+
+  template<typename T>
+  unsigned int
+  SasAnalysis_Read<T>::loadLimit() const
+  {
+    // As before, one more chunk is the one being read
+    return std::max(std::min<unsigned int>(Base::bufferMax - 1,
+                                           slots.size()), 1u);
+  }
+
   template<typename T>
   void
   SasAnalysis_Write<T>::dumpChunk(const std::vector<SasAtom*>& chunk,
@@ -533,56 +1002,51 @@ namespace PstpFinder
     unsigned int size = chunk.size();
     out << size;
 
-    for(const SasAtom* frame : chunk)
+    if(Base::compact)
     {
-      if(Base::gromacs and Base::gromacs->isAborting())
-        break;
-      const SasAtom* end = frame + Base::nAtoms;
-      for(const SasAtom* atom = frame; atom < end; ++atom)
-        out << *atom;
+      // Gathered first, so that the whole chunk is a single write
+      Base::sasData.resize(static_cast<std::size_t>(size) * Base::nAtoms);
+      real* sas = Base::sasData.data();
+      for(const SasAtom* frame : chunk)
+      {
+        const SasAtom* end = frame + Base::nAtoms;
+        for(const SasAtom* atom = frame; atom < end; ++atom)
+          *sas++ = atom->sas;
+      }
     }
-  }
 
-  template<typename T>
-  std::vector<SasAtom*>
-  SasAnalysis_Read<T>::loadChunk(Serializer<MetaStream<T>>& in)
-  {
-    unsigned int size;
-    std::vector<SasAtom*> chunk;
-    SasAtom* atoms;
-    SasAtom* atom;
-
-    in >> size;
-    chunk.reserve(size);
-
-    for(unsigned int i = 0; i < size; i++)
+    if(Base::codec.getPrecision() > 0)
     {
-      atoms = new SasAtom[Base::nAtoms];
-      atom = atoms;
+      Base::codec.encode(Base::sasData.data(), size, Base::codecData);
+      unsigned int encodedBytes = Base::codecData.size();
+      out << encodedBytes;
+      out.writeArray(Base::codecData.data(), encodedBytes);
+      return;
+    }
 
-      for(unsigned int k = 0; k < Base::nAtoms; k++, atom++)
-      {
-        if(Base::gromacs and Base::gromacs->isAborting())
-          return chunk;
-        try
-        {
-          in >> *atom;
-        }
-        catch(int e)
-        {
-          std::cerr << "Warning: inconsistent binary file." << std::endl;
-          SasAtom* tmpatoms = new SasAtom[k];
-          std::copy(atoms, atoms + k, tmpatoms);
-          delete[] atoms;
-          atoms = tmpatoms;
-          break;
-        }
-      }
+    if(Base::aligned)
+    {
+      for(std::streamoff padding =
+            Base::chunkPadding(Base::sasMetaStream.tellp());
+          padding > 0; padding--)
+        out << static_cast<unsigned char>(0);
+    }
 
-      chunk.push_back(atoms);
+    if(Base::compact)
+    {
+      if(not Base::gromacs or not Base::gromacs->isAborting())
+        out.writeArray(Base::sasData.data(), Base::sasData.size());
+      return;
     }
 
-    return chunk;
+    static_assert(sizeof(SasAtom) == sizeof(real) * 4,
+                  "SasAtom must be serialized as it is laid out");
+    for(const SasAtom* frame : chunk)
+    {
+      if(Base::gromacs and Base::gromacs->isAborting())
+        break;
+      out.writeArray(reinterpret_cast<const real*>(frame), Base::nAtoms * 4);
+    }
   }
 
   template<typename T>
@@ -593,6 +1057,7 @@ namespace PstpFinder
       return false;
 
     maxBytes = bytes;
+    fixedBytes = true;
     updateChunks();
 
     return true;
@@ -613,6 +1078,7 @@ namespace PstpFinder
       return false;
 
     maxChunk = bytes;
+    fixedChunk = true;
     updateChunks();
 
     return true;
@@ -629,22 +1095,21 @@ namespace PstpFinder
   void
   SasAnalysis_Base<T>::updateChunks()
   {
-    // SasAtom serialization produces real * 4
     maxFrames = maxChunk / (nAtoms * sizeof(real) * 4);
-    std::vector<SasAtom*> testVector(maxFrames);
-    unsigned int vectorSize = testVector.capacity()
-                              * (sizeof(SasAtom*) + sizeof(SasAtom) * nAtoms)
-                              + sizeof(std::vector<SasAtom*> );
-
-    bufferMax = maxBytes / vectorSize;
+    bufferMax = maxBytes / chunkBytes(maxFrames);
     if(bufferMax == 0)
     {
+      // Once running, chunks stored bigger than the budget are read anyway
+      if(not changeable)
+      {
+        bufferMax = 1;
+        return;
+      }
+
       std::cerr << "Can't allocate memory... Strange. Is your RAM full?" <<
           std::endl;
       throw std::bad_alloc();
     }
-
-    chunks = boost::circular_buffer<std::vector<SasAtom*> >(bufferMax);
   }
 
   template<typename T>
@@ -652,7 +1117,10 @@ namespace PstpFinder
   SasAnalysis_Read<T>::updateChunks()
   {
     Base::updateChunks();
-    Base::bufferCount = 0;
+    // The budget can grow while reading, the slots are there already
+    slots.resize(SAS_MAX_CHUNKS);
+    for(LoadedChunk& slot : slots)
+      slot.ready = false;
   }
 
   template<typename T>
@@ -660,7 +1128,38 @@ namespace PstpFinder
   SasAnalysis_Write<T>::updateChunks()
   {
     Base::updateChunks();
-    Base::bufferCount = Base::bufferMax - 1;
+
+    // The depth follows bufferMax, one more chunk is always being filled
+    ring.reset(new SpscRing<std::vector<SasAtom*>>(SAS_MAX_CHUNKS));
+    ring->setDepth(Base::bufferMax - 1);
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::adaptChunks()
+  {
+    const auto now = std::chrono::steady_clock::now();
+    const double seconds =
+        std::chrono::duration<double>(now - chunkStart).count();
+    chunkStart = now;
+
+    /*
+     * Slow analyses keep few frames in memory, fast ones don't pay a chunk
+     * header and a codec restart every few frames. The share of the budget
+     * can change as other analyses start and end.
+     */
+    Base::updateBudget();
+    if(not Base::fixedChunk and seconds > 0)
+    {
+      const double frameRate = Base::frames.size() / seconds;
+      const unsigned long frames = std::max(
+          static_cast<unsigned long>(frameRate * SAS_CHUNK_SECONDS), 1ul);
+      Base::maxChunk = std::min(Base::chunkBytes(frames),
+                                std::max(Base::maxBytes / 2,
+                                         Base::chunkBytes(1)));
+    }
+    Base::updateChunks();
+    ring->setDepth(Base::bufferMax - 1);
   }
 
   template<typename T>
@@ -669,6 +1168,34 @@ namespace PstpFinder
   {
     return readFrames;
   }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::setCheckpointChunks(unsigned int chunks)
+  {
+    checkpointChunks = chunks;
+  }
+
+  template<typename T>
+  unsigned int
+  SasAnalysis_Write<T>::getCheckpointChunks() const
+  {
+    return checkpointChunks;
+  }
+
+  template<typename T>
+  void
+  SasAnalysis_Write<T>::setSyncPolicy(SasChunkIndex::SyncPolicy policy)
+  {
+    syncPolicy = policy;
+  }
+
+  template<typename T>
+  SasChunkIndex::SyncPolicy
+  SasAnalysis_Write<T>::getSyncPolicy() const
+  {
+    return syncPolicy;
+  }
 }
 #endif
 
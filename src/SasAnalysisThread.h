@@ -23,6 +23,8 @@
 #include "SasAnalysis.h"
 
 #include <thread>
+#include <vector>
+#include <algorithm>
 
 namespace PstpFinder
 {
@@ -32,7 +34,6 @@ namespace PstpFinder
     public:
       SasAnalysisThread_Base(SasClass& parent);
       virtual ~SasAnalysisThread_Base();
-      virtual void wakeUp();
       virtual void stop();
       void threadSave();
       void threadOpen();
@@ -41,8 +42,6 @@ namespace PstpFinder
       SasClass* parent;
       bool isStopped;
       std::thread analysisThread;
-      std::condition_variable wakeCondition;
-      std::mutex wakeMutex;
   };
 
   template<typename T, typename SasClass>
@@ -62,109 +61,29 @@ namespace PstpFinder
   void
   SasAnalysisThread_Base<T, SasClass>::threadSave()
   {
-    while(not isStopped)
-    {
-      parent->bufferMutex.lock();
-
-      while(parent->bufferCount == parent->bufferMax - 1 and not isStopped)
-      {
-        std::unique_lock<std::mutex> lock(wakeMutex);
-        parent->bufferMutex.unlock();
-        wakeCondition.wait(lock);
-        parent->bufferMutex.lock();
-      }
-
-      if(isStopped)
-      {
-        parent->bufferMutex.unlock();
-        break;
-      }
-
-      if(parent->save())
-      {
-        std::vector<SasAtom*>& curChunk = parent->chunks.front();
-        for(SasAtom* frame : curChunk)
-          delete[] frame;
-        curChunk.clear();
-
-        parent->chunks.pop_front();
-        parent->bufferCount++;
-        parent->bufferCountCondition.notify_all();
-      }
-
-      parent->bufferMutex.unlock();
-    }
-
-    parent->bufferMutex.lock();
-    while(parent->bufferCount < parent->bufferMax - 1)
-    {
-      parent->save();
-      parent->chunks.pop_front();
-      parent->bufferCount++;
-      parent->bufferCountCondition.notify_all();
-    }
-    parent->bufferMutex.unlock();
+    /*
+     * Chunks are saved without locks, the ring is drained once closed.
+     * The parent may be already in its destructor, so save() is not called
+     * through the vtable.
+     */
+    while(parent->ring->waitNotEmpty())
+      parent->SasClass::save();
   }
 
   template<typename T, typename SasClass>
   void
   SasAnalysisThread_Base<T, SasClass>::threadOpen()
   {
-    while(not isStopped)
-    {
-      parent->bufferMutex.lock();
-
-      while(parent->bufferCount == parent->bufferMax - 1 and not isStopped)
-      {
-        std::unique_lock<std::mutex> lock(wakeMutex);
-        parent->bufferMutex.unlock();
-        wakeCondition.wait(lock);
-        parent->bufferMutex.lock();
-      }
-
-      if(isStopped)
-      {
-        while(parent->bufferCount < parent->bufferMax - 1)
-        {
-          parent->bufferCount++;
-          parent->bufferCountCondition.notify_all();
-        }
-        parent->bufferMutex.unlock();
-        break;
-      }
-
-      if(not parent->open())
-        isStopped = true;
-
-      parent->bufferCount++;
-      parent->bufferCountCondition.notify_all();
-      parent->bufferMutex.unlock();
-    }
-  }
-
-  template<typename T, typename SasClass>
-  void
-  SasAnalysisThread_Base<T, SasClass>::wakeUp()
-  {
-    wakeCondition.notify_one();
+    // Codec state and buffers are kept by every thread between chunks
+    typename SasClass::Decoder decoder { parent->codec, {}, {} };
+    while(parent->open(decoder));
   }
 
   template<typename T, typename SasClass>
   void
   SasAnalysisThread_Base<T, SasClass>::stop()
   {
-    if(isStopped)
-    {
-      if(analysisThread.joinable())
-        analysisThread.join();
-      return;
-    }
-
-    parent->bufferMutex.lock();
     isStopped = true;
-    wakeCondition.notify_one();
-    parent->bufferMutex.unlock();
-
     if(analysisThread.joinable())
       analysisThread.join();
   }
@@ -183,11 +102,37 @@ namespace PstpFinder
       SasAnalysisThread(SasAnalysis_Read<T>& parent) :
         Base(parent)
       {
-        this->analysisThread = std::thread(
-            std::bind(&Base::threadOpen, std::ref(*this)));
+        // More decoders than chunks that can be loaded would only wait
+        const unsigned int nThreads = std::min(parent.decodeThreads,
+                                               parent.loadLimit());
+        for(unsigned int i = 0; i < nThreads; i++)
+          decoders.push_back(std::thread(
+              std::bind(&Base::threadOpen, std::ref(*this))));
       }
-      virtual ~SasAnalysisThread() {}
+      virtual ~SasAnalysisThread() { stop(); }
       virtual void threadOpen() { Base::threadOpen(); }
+
+      /**
+       * @brief Stops loading chunks and waits for the decoders
+       */
+      virtual void
+      stop()
+      {
+        if(not Base::isStopped)
+        {
+          Base::isStopped = true;
+          Base::parent->stopLoading();
+        }
+
+        for(std::thread& decoder : decoders)
+        {
+          if(decoder.joinable())
+            decoder.join();
+        }
+      }
+
+    private:
+      std::vector<std::thread> decoders;
   };
 
   template<typename T>
@@ -203,24 +148,32 @@ namespace PstpFinder
         this->analysisThread = std::thread(
             std::bind(&Base::threadSave, std::ref(*this)));
       }
-      virtual ~SasAnalysisThread() {}
+      virtual ~SasAnalysisThread() { stop(); }
       virtual void
       threadSave() { Base::threadSave(); }
 
+      /**
+       * @brief Saves the chunks left in the ring and ends the thread
+       */
+      virtual void
+      stop()
+      {
+        if(not Base::isStopped)
+        {
+          Base::isStopped = true;
+          Base::parent->ring->close();
+        }
+
+        if(Base::analysisThread.joinable())
+          Base::analysisThread.join();
+      }
+
       void waitForFlush()
       {
         if(Base::isStopped)
           return;
 
-        Base::parent->bufferMutex.lock();
-        while(Base::parent->bufferCount < Base::parent->bufferMax - 1 and not Base::isStopped)
-        {
-          std::unique_lock<std::mutex> lock(Base::parent->bufferCountMutex);
-          Base::parent->bufferMutex.unlock();
-          Base::parent->bufferCountCondition.wait(lock);
-          Base::parent->bufferMutex.lock();
-        }
-        Base::parent->bufferMutex.unlock();
+        Base::parent->ring->waitEmpty();
       }
   };
 }
@@ -0,0 +1,664 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasCalculator.h"
+
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+namespace PstpFinder
+{
+  SasCalculator::SasCalculator(unsigned int dots) :
+      adaptive(false), meanArea(nullptr), kernel(getSasKernel()), nScored(0),
+      incremental(false), skin(0.2), tolerance(0.001), verletValid(false),
+      verletPBC(epbcNONE), verletHasBox(false),
+      verletStrain(0), areaStrain(0)
+  {
+    setDots(dots);
+  }
+
+  SasCalculator::SasCalculator(unsigned int dots, SasKernelType kernelType) :
+      adaptive(false), meanArea(nullptr), kernel(getSasKernel(kernelType)),
+      nScored(0), incremental(false), skin(0.2), tolerance(0.001),
+      verletValid(false), verletPBC(epbcNONE), verletHasBox(false),
+      verletStrain(0), areaStrain(0)
+  {
+    setDots(dots);
+  }
+
+  unsigned int
+  SasCalculator::getDots() const
+  {
+    return nDots;
+  }
+
+  void
+  SasCalculator::setDots(unsigned int dots)
+  {
+    nDots = dots > 0 ? dots : 1;
+    makeDots();
+    verletValid = false;
+  }
+
+  bool
+  SasCalculator::isAdaptive() const
+  {
+    return adaptive;
+  }
+
+  void
+  SasCalculator::setAdaptive(bool value)
+  {
+    adaptive = value;
+    verletValid = false;
+  }
+
+  void
+  SasCalculator::setMeanArea(const std::vector<real>* mean)
+  {
+    meanArea = mean;
+  }
+
+  bool
+  SasCalculator::isIncremental() const
+  {
+    return incremental;
+  }
+
+  void
+  SasCalculator::setIncremental(bool value)
+  {
+    incremental = value;
+    verletValid = false;
+  }
+
+  real
+  SasCalculator::getSkin() const
+  {
+    return skin;
+  }
+
+  void
+  SasCalculator::setSkin(real value)
+  {
+    skin = value > 0 ? value : 0;
+    verletValid = false;
+  }
+
+  real
+  SasCalculator::getTolerance() const
+  {
+    return tolerance;
+  }
+
+  void
+  SasCalculator::setTolerance(real value)
+  {
+    tolerance = value > 0 ? value : 0;
+  }
+
+  static inline unsigned int
+  alignDots(unsigned int dots)
+  {
+    return (dots + SAS_KERNEL_DOTS_ALIGN - 1) / SAS_KERNEL_DOTS_ALIGN
+           * SAS_KERNEL_DOTS_ALIGN;
+  }
+
+  void
+  SasCalculator::makeDots()
+  {
+    // Golden section spiral: evenly distributed dots on the unit sphere
+    const double increment = M_PI * (3. - std::sqrt(5.));
+    const double offset = 2. / nDots;
+
+    // Dots taken evenly along the spiral are still evenly distributed
+    nCoarseDots = std::min(std::max((nDots + 3) / 4,
+                                    SAS_ADAPTIVE_COARSE_DOTS), nDots);
+    fineOffset = alignDots(nCoarseDots);
+
+    const unsigned int padded = fineOffset + alignDots(nDots - nCoarseDots);
+    dotX.assign(padded, 0);
+    dotY.assign(padded, 0);
+    dotZ.assign(padded, 0);
+    unsigned int coarse = 0;
+    for(unsigned int k = 0; k < nDots; k++)
+    {
+      const double y = k * offset - 1. + offset / 2.;
+      const double r = std::sqrt(1. - y * y);
+      const double phi = k * increment;
+      const bool isCoarse = (k + 1) * nCoarseDots / nDots
+                            > k * nCoarseDots / nDots;
+      const unsigned int slot = isCoarse ? coarse++
+                                : fineOffset + k - coarse;
+
+      dotX[slot] = std::cos(phi) * r;
+      dotY[slot] = y;
+      dotZ[slot] = std::sin(phi) * r;
+    }
+  }
+
+  unsigned int
+  SasCalculator::freeDots(unsigned int atom, unsigned int offset,
+                          unsigned int dots) const
+  {
+    return kernel(dotX.data() + offset, dotY.data() + offset,
+                  dotZ.data() + offset, dots, atomRadius[atom],
+                  neighbourX.data(), neighbourY.data(), neighbourZ.data(),
+                  neighbourR2.data(), neighbourX.size());
+  }
+
+  real
+  SasCalculator::atomArea(unsigned int atom) const
+  {
+    const real r = atomRadius[atom];
+    const real sphere = 4. * M_PI * r * r;
+    const unsigned int coarse = freeDots(atom, 0, nCoarseDots);
+
+    if(adaptive and meanArea and meanArea->size() == nScored
+       and nCoarseDots < nDots)
+    {
+      /*
+       * Binomial standard error of the coarse area. The fraction is taken
+       * as if one buried and one free dot more were sampled, so that the
+       * error of a fully buried or free atom is not zero.
+       */
+      const real coarseArea = sphere * coarse / nCoarseDots;
+      const real p = (coarse + 1.) / (nCoarseDots + 2.);
+      const real error = sphere * std::sqrt(p * (1 - p) / nCoarseDots);
+      if(std::abs(coarseArea - (*meanArea)[atom])
+         > SAS_ADAPTIVE_SIGMAS * error)
+        return coarseArea;
+    }
+
+    return sphere * (coarse + freeDots(atom, fineOffset,
+                                       nDots - nCoarseDots)) / nDots;
+  }
+
+  const std::vector<real>&
+  SasCalculator::calculate(const rvec* x, const real* radius,
+                           const std::vector<atom_id>& index, int ePBC,
+                           const matrix box)
+  {
+    return calculate(x, radius, index, std::vector<atom_id>(), ePBC, box);
+  }
+
+  const std::vector<real>&
+  SasCalculator::calculate(const rvec* x, const real* radius,
+                           const std::vector<atom_id>& index,
+                           const std::vector<atom_id>& occluders, int ePBC,
+                           const matrix box, const atom_id* ids)
+  {
+    const unsigned int nAtoms = index.size() + occluders.size();
+    nScored = index.size();
+
+    atomX.resize(nAtoms);
+    atomY.resize(nAtoms);
+    atomZ.resize(nAtoms);
+    atomRadius.resize(nAtoms);
+    areas.resize(nScored);
+
+    real maxRadius = 0;
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      const atom_id id = i < nScored ? index[i] : occluders[i - nScored];
+      atomX[i] = x[id][XX];
+      atomY[i] = x[id][YY];
+      atomZ[i] = x[id][ZZ];
+      atomRadius[i] = radius[id];
+      if(atomRadius[i] > maxRadius)
+        maxRadius = atomRadius[i];
+    }
+
+    if(incremental)
+    {
+      occluderIds.resize(occluders.size());
+      for(unsigned int i = 0; i < occluders.size(); i++)
+        occluderIds[i] = ids ? ids[occluders[i]] : occluders[i];
+
+      calculateIncremental(ePBC, box, maxRadius);
+      return areas;
+    }
+
+    // No sphere can touch another farther than two maximum radii
+    cellList.build(atomX.data(), atomY.data(), atomZ.data(), nAtoms,
+                   2 * maxRadius, ePBC, box);
+
+    for(unsigned int i = 0; i < nScored; i++)
+    {
+      collectNeighbours(i);
+      areas[i] = atomArea(i);
+    }
+
+    return areas;
+  }
+
+  void
+  SasCalculator::collectNeighbours(unsigned int atom)
+  {
+    const real r = atomRadius[atom];
+
+    neighbourX.clear();
+    neighbourY.clear();
+    neighbourZ.clear();
+    neighbourR2.clear();
+
+    cellList.forEachNeighbour(atom, [&](unsigned int j, real dx, real dy,
+                                        real dz)
+    {
+      const real cutoff = r + atomRadius[j];
+      if(dx * dx + dy * dy + dz * dz >= cutoff * cutoff)
+        return;
+
+      neighbourX.push_back(dx);
+      neighbourY.push_back(dy);
+      neighbourZ.push_back(dz);
+      neighbourR2.push_back(atomRadius[j] * atomRadius[j]);
+    });
+  }
+
+  void
+  SasCalculator::calculateIncremental(int ePBC, const matrix box,
+                                      real maxRadius)
+  {
+    const unsigned int nAtoms = atomX.size();
+
+    // A different kind of box or different scored atoms invalidate all
+    const bool computeAll = not verletValid
+                            or verletStart.size() != nScored + 1
+                            or verletPBC != ePBC
+                            or verletHasBox != (box != nullptr);
+
+    bool rebuild = computeAll;
+    forced.assign(nAtoms, 0);
+    if(not computeAll)
+    {
+      // Previous positions are scaled first, then moved to their new slot
+      if(box != nullptr and not std::equal(box[0], box[0] + DIM * DIM,
+                                           verletBox[0]))
+        scaleBox(box);
+      if(occluderIds != verletOccluderIds)
+        rebuild = remapOccluders(maxRadius);
+      if(not rebuild)
+        rebuild = verletExpired(maxRadius);
+    }
+
+    if(rebuild)
+      buildVerlet(ePBC, box, maxRadius);
+
+    // Scaled distances between neighbours must stay within the tolerance too
+    if(computeAll or areaStrain * 2 * maxRadius > tolerance)
+    {
+      lastX = atomX;
+      lastY = atomY;
+      lastZ = atomZ;
+      moved.assign(nAtoms, 1);
+      areaStrain = 0;
+    }
+    else
+    {
+      /*
+       * The reference of an atom is moved only when the atom goes beyond the
+       * tolerance. This way the positions used for a reused area never
+       * drift more than twice the tolerance from the current ones.
+       */
+      const real tolerance2 = tolerance * tolerance;
+      moved.resize(nAtoms);
+      for(unsigned int i = 0; i < nAtoms; i++)
+      {
+        const real dx = atomX[i] - lastX[i];
+        const real dy = atomY[i] - lastY[i];
+        const real dz = atomZ[i] - lastZ[i];
+        moved[i] = forced[i] or dx * dx + dy * dy + dz * dz > tolerance2;
+        if(moved[i])
+        {
+          lastX[i] = atomX[i];
+          lastY[i] = atomY[i];
+          lastZ[i] = atomZ[i];
+        }
+      }
+    }
+
+    for(unsigned int i = 0; i < nScored; i++)
+    {
+      bool changed = moved[i];
+      for(unsigned int p = verletStart[i]; p < verletStart[i + 1]
+          and not changed; p++)
+        changed = moved[verletAtom[p]];
+
+      if(not changed)
+        continue;
+
+      collectVerletNeighbours(i);
+      areas[i] = atomArea(i);
+    }
+  }
+
+  /*
+   * GROMACS boxes are lower triangular and positions are row vectors, so
+   * the scaling from the previous box is inverse(previous) * box.
+   */
+  void
+  SasCalculator::scaleBox(const matrix box)
+  {
+    const matrix& old = verletBox;
+    matrix inverse = { { 0 } };
+    inverse[XX][XX] = 1 / old[XX][XX];
+    inverse[YY][YY] = 1 / old[YY][YY];
+    inverse[ZZ][ZZ] = 1 / old[ZZ][ZZ];
+    inverse[YY][XX] = -old[YY][XX] / (old[XX][XX] * old[YY][YY]);
+    inverse[ZZ][YY] = -old[ZZ][YY] / (old[YY][YY] * old[ZZ][ZZ]);
+    inverse[ZZ][XX] = (old[YY][XX] * old[ZZ][YY] - old[YY][YY] * old[ZZ][XX])
+                      / (old[XX][XX] * old[YY][YY] * old[ZZ][ZZ]);
+
+    matrix scale;
+    real strain = 0;
+    for(int m = 0; m < DIM; m++)
+      for(int n = 0; n < DIM; n++)
+      {
+        scale[m][n] = 0;
+        for(int k = 0; k < DIM; k++)
+          scale[m][n] += inverse[m][k] * box[k][n];
+
+        // Frobenius norm, never less than the stretch of any distance
+        const real d = scale[m][n] - (m == n ? 1 : 0);
+        strain += d * d;
+      }
+    strain = std::sqrt(strain);
+    verletStrain += strain;
+    areaStrain += strain;
+
+    auto scaleAll = [&scale](std::vector<real>& x, std::vector<real>& y,
+                             std::vector<real>& z)
+    {
+      for(unsigned int i = 0; i < x.size(); i++)
+      {
+        const real sx = x[i] * scale[XX][XX] + y[i] * scale[YY][XX]
+                        + z[i] * scale[ZZ][XX];
+        const real sy = x[i] * scale[XX][YY] + y[i] * scale[YY][YY]
+                        + z[i] * scale[ZZ][YY];
+        const real sz = x[i] * scale[XX][ZZ] + y[i] * scale[YY][ZZ]
+                        + z[i] * scale[ZZ][ZZ];
+        x[i] = sx;
+        y[i] = sy;
+        z[i] = sz;
+      }
+    };
+
+    // Shifts are whole box vectors, they follow the box too
+    scaleAll(verletX, verletY, verletZ);
+    scaleAll(lastX, lastY, lastZ);
+    scaleAll(verletShiftX, verletShiftY, verletShiftZ);
+    std::copy(box[0], box[0] + DIM * DIM, verletBox[0]);
+  }
+
+  /*
+   * Moves what is kept of every occluder to its slot in this frame. Lists
+   * lose the occluders that are gone, and their atoms are calculated again.
+   * Returns true when the lists must be built again, because an occluder
+   * came in closer than the skin to a scored atom.
+   */
+  bool
+  SasCalculator::remapOccluders(real maxRadius)
+  {
+    const unsigned int nAtoms = atomX.size();
+    const unsigned int nOld = verletOccluderIds.size();
+
+    for(unsigned int k = 0; k < occluderIds.size(); k++)
+    {
+      if(static_cast<std::size_t>(occluderIds[k]) >= occluderSlot.size())
+        occluderSlot.resize(occluderIds[k] + 1, -1);
+      occluderSlot[occluderIds[k]] = nScored + k;
+    }
+
+    std::vector<int> newSlot(nOld);
+    for(unsigned int k = 0; k < nOld; k++)
+      newSlot[k] = static_cast<std::size_t>(verletOccluderIds[k])
+                   < occluderSlot.size() ?
+                   occluderSlot[verletOccluderIds[k]] : -1;
+
+    for(atom_id id : occluderIds)
+      occluderSlot[id] = -1;
+
+    // Occluders coming in start from where they are now
+    std::fill(forced.begin() + nScored, forced.end(), 1);
+    for(unsigned int k = 0; k < nOld; k++)
+      if(newSlot[k] >= 0)
+        forced[newSlot[k]] = 0;
+
+    auto remap = [&](std::vector<real>& values, const std::vector<real>& now)
+    {
+      std::vector<real> remapped(now);
+      std::copy(values.begin(), values.begin() + nScored, remapped.begin());
+      for(unsigned int k = 0; k < nOld; k++)
+        if(newSlot[k] >= 0)
+          remapped[newSlot[k]] = values[nScored + k];
+      values.swap(remapped);
+    };
+    remap(verletX, atomX);
+    remap(verletY, atomY);
+    remap(verletZ, atomZ);
+    remap(lastX, atomX);
+    remap(lastY, atomY);
+    remap(lastZ, atomZ);
+
+    unsigned int kept = 0;
+    for(unsigned int i = 0; i < nScored; i++)
+    {
+      const unsigned int start = verletStart[i];
+      verletStart[i] = kept;
+      for(unsigned int p = start; p < verletStart[i + 1]; p++)
+      {
+        int j = verletAtom[p];
+        if(j >= static_cast<int>(nScored))
+          j = newSlot[j - nScored];
+        if(j < 0)
+        {
+          forced[i] = 1;
+          continue;
+        }
+
+        verletAtom[kept] = j;
+        verletShiftX[kept] = verletShiftX[p];
+        verletShiftY[kept] = verletShiftY[p];
+        verletShiftZ[kept] = verletShiftZ[p];
+        kept++;
+      }
+    }
+    verletStart[nScored] = kept;
+    verletAtom.resize(kept);
+    verletShiftX.resize(kept);
+    verletShiftY.resize(kept);
+    verletShiftZ.resize(kept);
+    verletOccluderIds = occluderIds;
+
+    if(std::find(forced.begin() + nScored, forced.end(), 1) == forced.end())
+      return false;
+
+    cellList.build(atomX.data(), atomY.data(), atomZ.data(), nAtoms,
+                   2 * maxRadius + skin, verletPBC,
+                   verletHasBox ? verletBox : nullptr);
+    for(unsigned int f = nScored; f < nAtoms; f++)
+    {
+      if(not forced[f])
+        continue;
+
+      bool near = false;
+      cellList.forEachNeighbour(f, [&](unsigned int j, real dx, real dy,
+                                       real dz)
+      {
+        const real cutoff = atomRadius[f] + atomRadius[j] + skin;
+        if(j < nScored and dx * dx + dy * dy + dz * dz < cutoff * cutoff)
+          near = true;
+      });
+      if(near)
+        return true;
+    }
+
+    return false;
+  }
+
+  bool
+  SasCalculator::verletExpired(real maxRadius) const
+  {
+    /*
+     * A pair out of the lists was farther than the cutoff plus the skin.
+     * The strain of the box can bring it closer by strain * (cutoff + skin),
+     * and each atom can take half of what is left.
+     */
+    const unsigned int nAtoms = atomX.size();
+    const real half = (skin - verletStrain * (2 * maxRadius + skin)) / 2;
+    if(half <= 0)
+      return true;
+    const real limit = half * half;
+
+    for(unsigned int i = 0; i < nAtoms; i++)
+    {
+      const real dx = atomX[i] - verletX[i];
+      const real dy = atomY[i] - verletY[i];
+      const real dz = atomZ[i] - verletZ[i];
+      if(dx * dx + dy * dy + dz * dz > limit)
+        return true;
+    }
+
+    return false;
+  }
+
+  void
+  SasCalculator::buildVerlet(int ePBC, const matrix box, real maxRadius)
+  {
+    const unsigned int nAtoms = atomX.size();
+
+    cellList.build(atomX.data(), atomY.data(), atomZ.data(), nAtoms,
+                   2 * maxRadius + skin, ePBC, box);
+
+    // Lists are needed only for the scored atoms
+    verletStart.resize(nScored + 1);
+    verletAtom.clear();
+    verletShiftX.clear();
+    verletShiftY.clear();
+    verletShiftZ.clear();
+
+    verletStart[0] = 0;
+    for(unsigned int i = 0; i < nScored; i++)
+    {
+      const real r = atomRadius[i] + skin;
+      cellList.forEachNeighbour(i, [&](unsigned int j, real dx, real dy,
+                                       real dz)
+      {
+        const real cutoff = r + atomRadius[j];
+        if(dx * dx + dy * dy + dz * dz >= cutoff * cutoff)
+          return;
+
+        // Keep the periodic image, the distance is recomputed every frame
+        verletAtom.push_back(j);
+        verletShiftX.push_back(dx - (atomX[j] - atomX[i]));
+        verletShiftY.push_back(dy - (atomY[j] - atomY[i]));
+        verletShiftZ.push_back(dz - (atomZ[j] - atomZ[i]));
+      });
+      verletStart[i + 1] = verletAtom.size();
+    }
+
+    verletX = atomX;
+    verletY = atomY;
+    verletZ = atomZ;
+    verletOccluderIds = occluderIds;
+    verletPBC = ePBC;
+    verletHasBox = box != nullptr;
+    if(box != nullptr)
+      std::copy(box[0], box[0] + DIM * DIM, verletBox[0]);
+    verletStrain = 0;
+    verletValid = true;
+  }
+
+  void
+  SasCalculator::collectVerletNeighbours(unsigned int atom)
+  {
+    const real r = atomRadius[atom];
+
+    neighbourX.clear();
+    neighbourY.clear();
+    neighbourZ.clear();
+    neighbourR2.clear();
+
+    for(unsigned int p = verletStart[atom]; p < verletStart[atom + 1]; p++)
+    {
+      const unsigned int j = verletAtom[p];
+      const real dx = atomX[j] - atomX[atom] + verletShiftX[p];
+      const real dy = atomY[j] - atomY[atom] + verletShiftY[p];
+      const real dz = atomZ[j] - atomZ[atom] + verletShiftZ[p];
+      const real cutoff = r + atomRadius[j];
+      if(dx * dx + dy * dy + dz * dz >= cutoff * cutoff)
+        continue;
+
+      neighbourX.push_back(dx);
+      neighbourY.push_back(dy);
+      neighbourZ.push_back(dz);
+      neighbourR2.push_back(atomRadius[j] * atomRadius[j]);
+    }
+  }
+
+  SasMeanArea::SasMeanArea(unsigned int frames) :
+      warmupFrames(frames), addedFrames(0), frameAreas(frames),
+      ready(frames == 0)
+  {
+  }
+
+  bool
+  SasMeanArea::isWarmup(unsigned int frame) const
+  {
+    return frame < warmupFrames;
+  }
+
+  void
+  SasMeanArea::add(unsigned int frame, std::vector<real>&& areas)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(ready or frame >= warmupFrames or not frameAreas[frame].empty())
+      return;
+
+    frameAreas[frame] = std::move(areas);
+    if(++addedFrames < warmupFrames)
+      return;
+
+    // Summed in frame order, so the mean is always the same
+    mean.assign(frameAreas[0].size(), 0);
+    for(const std::vector<real>& frameArea : frameAreas)
+      for(unsigned int i = 0; i < mean.size() and i < frameArea.size(); i++)
+        mean[i] += frameArea[i] / warmupFrames;
+
+    frameAreas.clear();
+    ready = true;
+    condition.notify_all();
+  }
+
+  const std::vector<real>*
+  SasMeanArea::get(const std::function<bool()>& abort)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while(not ready)
+    {
+      if(abort())
+        return nullptr;
+      condition.wait_for(lock, std::chrono::milliseconds(100));
+    }
+
+    return &mean;
+  }
+}
@@ -0,0 +1,198 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SASCALCULATOR_H
+#define _SASCALCULATOR_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "SasKernel.h"
+#include "CellList.h"
+
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  // Fewest dots of the first pass of adaptive mode
+  constexpr unsigned int SAS_ADAPTIVE_COARSE_DOTS = 16;
+  // Standard errors of the first pass within which an area is refined
+  constexpr real SAS_ADAPTIVE_SIGMAS = 2;
+  // Frames refined everywhere to get the mean area of adaptive mode
+  constexpr unsigned int SAS_ADAPTIVE_WARMUP_FRAMES = 8;
+
+  /**
+   * @brief Mean SAS of every atom over the first frames, for adaptive mode
+   *
+   * Shared by all the threads, summed in frame order and then frozen.
+   */
+  class SasMeanArea
+  {
+    public:
+      SasMeanArea(unsigned int frames = SAS_ADAPTIVE_WARMUP_FRAMES);
+
+      bool isWarmup(unsigned int frame) const;
+      void add(unsigned int frame, std::vector<real>&& areas);
+
+      /**
+       * @brief Waits for the warm-up frames and returns the mean
+       * @return nullptr if abort returned true before the mean was ready
+       */
+      const std::vector<real>* get(const std::function<bool()>& abort);
+
+    private:
+      const unsigned int warmupFrames;
+      unsigned int addedFrames;
+      std::vector<std::vector<real>> frameAreas;
+      std::vector<real> mean;
+      bool ready;
+      std::mutex mutex;
+      std::condition_variable condition;
+  };
+
+  /**
+   * @brief Reentrant Shrake-Rupley solvent accessible surface calculator
+   *
+   * The area of an atom is the fraction of the dots on its sphere not buried
+   * by other spheres. Unlike nsc_dclm_pbc, instances can run in parallel.
+   *
+   * In incremental mode consecutive frames reuse neighbour lists while atoms
+   * move less than half the skin, and areas while they move less than the
+   * tolerance.
+   *
+   * In adaptive mode only the atoms whose coarse area is close to the mean
+   * given by setMeanArea(), where Pittpi opens pockets, use all the dots.
+   */
+  class SasCalculator
+  {
+    public:
+      SasCalculator(unsigned int dots = 24);
+      SasCalculator(unsigned int dots, SasKernelType kernelType);
+
+      unsigned int getDots() const;
+      void setDots(unsigned int dots);
+      bool isAdaptive() const;
+      void setAdaptive(bool value);
+      void setMeanArea(const std::vector<real>* mean);
+      bool isIncremental() const;
+      void setIncremental(bool value);
+      real getSkin() const;
+      void setSkin(real value);
+      real getTolerance() const;
+      void setTolerance(real value);
+
+      /**
+       * @brief Calculates the SAS for the atoms in index
+       *
+       * @param x Coordinates of the whole system
+       * @param radius Radii of the whole system, solvent included
+       * @param index Atoms to analyse. Only these atoms bury each other.
+       * @param ePBC PBC type, as used by GROMACS
+       * @param box Box of the frame, or nullptr to disable PBC
+       * @return The area of every atom in index, in the same order
+       */
+      const std::vector<real>&
+      calculate(const rvec* x, const real* radius,
+                const std::vector<atom_id>& index, int ePBC,
+                const matrix box);
+
+      /**
+       * @brief Calculates the SAS for the atoms in index
+       *
+       * The atoms in occluders bury the ones in index, but their area is not
+       * calculated.
+       * @param ids Identity of every atom of x, to follow occluders between
+       *        frames when x holds a different set of atoms every time.
+       *        Without it, the position in x is used.
+       */
+      const std::vector<real>&
+      calculate(const rvec* x, const real* radius,
+                const std::vector<atom_id>& index,
+                const std::vector<atom_id>& occluders, int ePBC,
+                const matrix box, const atom_id* ids = nullptr);
+
+    private:
+      unsigned int nDots, nCoarseDots;
+      bool adaptive;
+      // Mean area of every scored atom, for adaptive mode
+      const std::vector<real>* meanArea;
+      /*
+       * Unit sphere dots. The coarse subset comes first, then the others
+       * start at fineOffset. Both parts are padded to SAS_KERNEL_DOTS_ALIGN.
+       */
+      std::vector<real> dotX, dotY, dotZ;
+      unsigned int fineOffset;
+      SasKernel kernel;
+
+      // Per-frame scratch buffers, reused between calls. Scored atoms first.
+      unsigned int nScored;
+      std::vector<real> atomX, atomY, atomZ, atomRadius;
+      std::vector<real> neighbourX, neighbourY, neighbourZ, neighbourR2;
+      std::vector<real> areas;
+      CellList cellList;
+
+      // Incremental mode state
+      bool incremental;
+      real skin, tolerance;
+      bool verletValid;
+      int verletPBC;
+      bool verletHasBox;
+      // Box of the previous frame
+      matrix verletBox;
+      // Strain of the box since the lists were built and since every area
+      real verletStrain, areaStrain;
+      std::vector<real> verletX, verletY, verletZ;
+      std::vector<atom_id> occluderIds, verletOccluderIds;
+      std::vector<unsigned int> verletStart, verletAtom;
+      std::vector<real> verletShiftX, verletShiftY, verletShiftZ;
+      std::vector<real> lastX, lastY, lastZ;
+      std::vector<unsigned char> moved;
+      // Atoms taken as moved: occluders coming in, atoms losing neighbours
+      std::vector<unsigned char> forced;
+      // Slot of an occluder from its id, -1 when it is not there
+      std::vector<int> occluderSlot;
+
+      void makeDots();
+      unsigned int freeDots(unsigned int atom, unsigned int offset,
+                            unsigned int dots) const;
+      real atomArea(unsigned int atom) const;
+      void collectNeighbours(unsigned int atom);
+      void calculateIncremental(int ePBC, const matrix box, real maxRadius);
+      void scaleBox(const matrix box);
+      bool remapOccluders(real maxRadius);
+      bool verletExpired(real maxRadius) const;
+      void buildVerlet(int ePBC, const matrix box, real maxRadius);
+      void collectVerletNeighbours(unsigned int atom);
+  };
+}
+
+#endif /* _SASCALCULATOR_H */
@@ -0,0 +1,297 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasCalculator.h"
+#include "UnitTest.h"
+
+#include <vector>
+#include <cmath>
+#include <random>
+
+using namespace PstpFinder;
+using UnitTest::check;
+
+static const unsigned int nBlob = 80;
+
+static bool
+near(double value, double expected, double tolerance)
+{
+  return std::fabs(value - expected) <= tolerance;
+}
+
+/*
+ * A small blob of atoms, not too packed, so that some of them are buried
+ * and some are not.
+ */
+static void
+makeBlob(rvec* x, std::vector<real>& radius, std::vector<atom_id>& index,
+         std::mt19937& random)
+{
+  std::uniform_real_distribution<real> position(0.5, 2.0);
+  std::uniform_real_distribution<real> size(0.25, 0.35);
+
+  radius.resize(nBlob);
+  index.resize(nBlob);
+  for(unsigned int i = 0; i < nBlob; i++)
+  {
+    for(int d = 0; d < DIM; d++)
+      x[i][d] = position(random);
+    radius[i] = size(random);
+    index[i] = i;
+  }
+}
+
+static void
+testKernels()
+{
+  // Every kernel must count exactly the same dots as the scalar one
+  std::mt19937 random(42);
+  std::uniform_real_distribution<real> coordinate(-0.6, 0.6);
+  std::uniform_real_distribution<real> unit(-1, 1);
+
+  const unsigned int nDots = 3 * SAS_KERNEL_DOTS_ALIGN;
+  std::vector<real> dotX(nDots), dotY(nDots), dotZ(nDots);
+  for(unsigned int k = 0; k < nDots; k++)
+  {
+    real dx, dy, dz, norm;
+    do
+    {
+      dx = unit(random);
+      dy = unit(random);
+      dz = unit(random);
+      norm = std::sqrt(dx * dx + dy * dy + dz * dz);
+    } while(norm < 0.1 or norm > 1);
+    dotX[k] = dx / norm;
+    dotY[k] = dy / norm;
+    dotZ[k] = dz / norm;
+  }
+
+  SasKernel scalar = getSasKernel(SasKernelType::SCALAR);
+  const SasKernelType types[] = { SasKernelType::AVX2,
+                                  SasKernelType::AVX512 };
+  for(unsigned int nNeighbours = 0; nNeighbours < 40; nNeighbours += 3)
+  {
+    std::vector<real> neighbourX(nNeighbours), neighbourY(nNeighbours),
+                      neighbourZ(nNeighbours), neighbourR2(nNeighbours);
+    for(unsigned int n = 0; n < nNeighbours; n++)
+    {
+      neighbourX[n] = coordinate(random);
+      neighbourY[n] = coordinate(random);
+      neighbourZ[n] = coordinate(random);
+      neighbourR2[n] = 0.09;
+    }
+
+    const unsigned int expected = scalar(dotX.data(), dotY.data(),
+                                         dotZ.data(), nDots, 0.3,
+                                         neighbourX.data(),
+                                         neighbourY.data(),
+                                         neighbourZ.data(),
+                                         neighbourR2.data(), nNeighbours);
+    for(SasKernelType type : types)
+    {
+      SasKernel kernel = getSasKernel(type);
+      check(kernel(dotX.data(), dotY.data(), dotZ.data(), nDots, 0.3,
+                   neighbourX.data(), neighbourY.data(), neighbourZ.data(),
+                   neighbourR2.data(), nNeighbours) == expected,
+            "kernels: vector kernel differs from the scalar one");
+    }
+  }
+}
+
+static void
+testIsolatedSphere()
+{
+  rvec x[2] = { { 1, 1, 1 }, { 3, 1, 1 } };
+  real radius[2] = { 0.3, 0.5 };
+  std::vector<atom_id> index = { 0, 1 };
+
+  SasCalculator calculator(50);
+  const std::vector<real>& areas = calculator.calculate(x, radius, index,
+                                                        epbcNONE, nullptr);
+  check(areas.size() == 2, "isolated sphere: wrong number of areas");
+  check(near(areas[0], 4 * M_PI * 0.3 * 0.3, 1e-5)
+        and near(areas[1], 4 * M_PI * 0.5 * 0.5, 1e-5),
+        "isolated sphere: area is not the whole sphere");
+}
+
+static void
+testOverlap()
+{
+  // Exposed area of two overlapping spheres is the sphere minus a cap
+  const real r1 = 0.4, r2 = 0.3, d = 0.5;
+  rvec x[2] = { { 1, 1, 1 }, { 1 + d, 1, 1 } };
+  real radius[2] = { r1, r2 };
+  std::vector<atom_id> index = { 0, 1 };
+
+  SasCalculator calculator(2000);
+  const std::vector<real>& areas = calculator.calculate(x, radius, index,
+                                                        epbcNONE, nullptr);
+
+  const double h1 = r1 - (d * d + r1 * r1 - r2 * r2) / (2 * d);
+  const double h2 = r2 - (d * d + r2 * r2 - r1 * r1) / (2 * d);
+  const double area1 = 4 * M_PI * r1 * r1 - 2 * M_PI * r1 * h1;
+  const double area2 = 4 * M_PI * r2 * r2 - 2 * M_PI * r2 * h2;
+  check(near(areas[0], area1, area1 * 0.01)
+        and near(areas[1], area2, area2 * 0.01),
+        "overlap: area differs from the analytic one");
+}
+
+static void
+testPeriodicImage()
+{
+  /*
+   * A blob split across the box boundary must give the same areas as the
+   * same blob shifted back inside the box.
+   */
+  std::mt19937 random(7);
+  rvec x[nBlob];
+  std::vector<real> radius;
+  std::vector<atom_id> index;
+  makeBlob(x, radius, index, random);
+
+  matrix box = { { 4, 0, 0 }, { 0, 4, 0 }, { 0, 0, 4 } };
+  SasCalculator calculator(64);
+  const std::vector<real> inside = calculator.calculate(x, radius.data(),
+                                                        index, epbcXYZ, box);
+
+  for(rvec& position : x)
+  {
+    position[XX] -= 1.2;
+    if(position[XX] < 0)
+      position[XX] += box[XX][XX];
+  }
+  const std::vector<real>& split = calculator.calculate(x, radius.data(),
+                                                        index, epbcXYZ, box);
+
+  bool same = true;
+  for(unsigned int i = 0; i < index.size(); i++)
+    same = same and near(split[i], inside[i], 1e-4);
+  check(same, "periodic image: split blob differs from the whole one");
+}
+
+static void
+testIncremental()
+{
+  // Small moves: incremental areas stay within the tolerance
+  std::mt19937 random(11);
+  std::uniform_real_distribution<real> jitter(-0.01, 0.01);
+  rvec x[nBlob];
+  std::vector<real> radius;
+  std::vector<atom_id> index;
+  makeBlob(x, radius, index, random);
+
+  SasCalculator full(64);
+  SasCalculator incremental(64);
+  incremental.setIncremental(true);
+
+  bool same = true;
+  for(unsigned int frame = 0; frame < 20; frame++)
+  {
+    for(rvec& position : x)
+      for(int d = 0; d < DIM; d++)
+        position[d] += jitter(random);
+
+    const std::vector<real>& expected = full.calculate(x, radius.data(),
+                                                       index, epbcNONE,
+                                                       nullptr);
+    const std::vector<real>& areas = incremental.calculate(x, radius.data(),
+                                                           index, epbcNONE,
+                                                           nullptr);
+    for(unsigned int i = 0; i < index.size(); i++)
+    {
+      const real r = radius[i];
+      same = same and near(areas[i], expected[i],
+                           4 * M_PI * r * r * 2 / 64.);
+    }
+  }
+  check(same, "incremental: areas differ from the full calculation");
+}
+
+static void
+testAdaptive()
+{
+  /*
+   * Warm-up frames added in any order give the same mean, and calculators
+   * sharing it give the same areas whatever frames they got before.
+   */
+  std::mt19937 random(13);
+  std::uniform_real_distribution<real> jitter(-0.02, 0.02);
+  rvec x[nBlob];
+  std::vector<real> radius;
+  std::vector<atom_id> index;
+  makeBlob(x, radius, index, random);
+
+  const unsigned int nWarmup = 4;
+  std::vector<std::vector<real>> warmup;
+  SasCalculator full(64);
+  for(unsigned int frame = 0; frame < nWarmup; frame++)
+  {
+    for(rvec& position : x)
+      for(int d = 0; d < DIM; d++)
+        position[d] += jitter(random);
+    warmup.push_back(full.calculate(x, radius.data(), index, epbcNONE,
+                                    nullptr));
+  }
+
+  SasMeanArea forward(nWarmup), backward(nWarmup);
+  for(unsigned int frame = 0; frame < nWarmup; frame++)
+  {
+    forward.add(frame, std::vector<real>(warmup[frame]));
+    backward.add(nWarmup - 1 - frame,
+                 std::vector<real>(warmup[nWarmup - 1 - frame]));
+  }
+  auto never = []() { return false; };
+  const std::vector<real>* forwardMean = forward.get(never);
+  const std::vector<real>* backwardMean = backward.get(never);
+  check(forwardMean and backwardMean and *forwardMean == *backwardMean,
+        "adaptive: mean depends on the order of the warm-up frames");
+
+  SasCalculator first(64), second(64);
+  first.setAdaptive(true);
+  second.setAdaptive(true);
+  first.setMeanArea(forwardMean);
+  second.setMeanArea(backwardMean);
+  // Only the first calculator sees another frame before
+  first.calculate(x, radius.data(), index, epbcNONE, nullptr);
+  for(rvec& position : x)
+    for(int d = 0; d < DIM; d++)
+      position[d] += jitter(random);
+  const std::vector<real> areas = first.calculate(x, radius.data(), index,
+                                                  epbcNONE, nullptr);
+  check(areas == second.calculate(x, radius.data(), index, epbcNONE,
+                                  nullptr),
+        "adaptive: areas depend on the previous frames");
+
+  SasMeanArea aborted(nWarmup);
+  check(not aborted.get([]() { return true; }),
+        "adaptive: waiting for the mean is not aborted");
+}
+
+int
+main()
+{
+  testKernels();
+  testIsolatedSphere();
+  testOverlap();
+  testPeriodicImage();
+  testIncremental();
+  testAdaptive();
+
+  return UnitTest::result();
+}
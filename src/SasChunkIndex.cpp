@@ -0,0 +1,303 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasChunkIndex.h"
+#include "Serializer.h"
+
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace PstpFinder
+{
+  static constexpr std::uint32_t sidecarMagic = 0x50535049; // "PSPI"
+  static constexpr std::uint32_t sidecarVersion = 2;
+  // Magic, version and offset of the SAS stream
+  static constexpr off_t prefixSize = 16;
+  // Sequence, chunks, SAS bytes and checksum
+  static constexpr off_t slotSize = 32;
+  static constexpr off_t headerSize = prefixSize + 2 * slotSize;
+  // First frame, offset, bytes, frames and padding
+  static constexpr off_t entrySize = 32;
+
+  SasChunkIndex::SasChunkIndex() :
+      fd(-1), sessionFd(-1), sasOffset(0), lastCheckpoint { 0, 0 },
+      sequence(0)
+  {
+  }
+
+  SasChunkIndex::~SasChunkIndex()
+  {
+    close();
+  }
+
+  bool
+  SasChunkIndex::create(const std::string& sessionFileName,
+                        std::uint64_t sasOffset)
+  {
+    close();
+
+    // Both slots are empty, a sequence of zero is never valid
+    std::stringstream header;
+    {
+      Serializer<std::stringstream> serializer(header);
+      serializer << sidecarMagic << sidecarVersion << sasOffset;
+      for(unsigned int slot = 0; slot < 2; slot++)
+        serializer << std::uint64_t(0) << std::uint64_t(0)
+                   << std::uint64_t(0) << std::uint64_t(0);
+    }
+    const std::string headerData = header.str();
+
+    fd = ::open(getSidecarFileName(sessionFileName).c_str(),
+                O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1)
+      return false;
+
+    if(pwrite(fd, headerData.data(), headerData.size(), 0) != headerSize)
+    {
+      close();
+      return false;
+    }
+
+    this->sasOffset = sasOffset;
+    sessionFd = ::open(sessionFileName.c_str(), O_RDONLY);
+    return true;
+  }
+
+  bool
+  SasChunkIndex::open(const std::string& sessionFileName,
+                      std::uint64_t sasOffset)
+  {
+    close();
+    this->sasOffset = sasOffset;
+
+    const std::string fileName = getSidecarFileName(sessionFileName);
+    {
+      std::ifstream stream(fileName,
+                           std::ios_base::in | std::ios_base::binary);
+      if(not stream)
+        return false;
+
+      Serializer<std::ifstream> serializer(stream);
+      std::uint32_t magic, version, padding;
+      std::uint64_t storedOffset;
+      serializer >> magic >> version >> storedOffset;
+      if(not stream or magic != sidecarMagic or version != sidecarVersion
+         or storedOffset != sasOffset)
+        return false;
+
+      std::uint64_t slotSequence[2], slotChecksum[2];
+      Checkpoint slotCheckpoint[2];
+      for(unsigned int slot = 0; slot < 2; slot++)
+        serializer >> slotSequence[slot] >> slotCheckpoint[slot].chunks
+                   >> slotCheckpoint[slot].sasBytes >> slotChecksum[slot];
+      if(not stream)
+        return false;
+
+      // An entry cut by a crash is not read
+      Entry entry;
+      while(true)
+      {
+        serializer >> entry.firstFrame >> entry.offset >> entry.bytes
+                   >> entry.frames >> padding;
+        if(not stream)
+          break;
+        entries.push_back(entry);
+      }
+
+      for(unsigned int slot = 0; slot < 2; slot++)
+      {
+        if(slotSequence[slot] > sequence
+           and slotChecksum[slot] == checksum(slotSequence[slot],
+                                              slotCheckpoint[slot])
+           and slotCheckpoint[slot].chunks <= entries.size())
+        {
+          sequence = slotSequence[slot];
+          lastCheckpoint = slotCheckpoint[slot];
+        }
+      }
+    }
+
+    fd = ::open(fileName.c_str(), O_RDWR);
+    if(fd == -1 or not truncate(entries.size()))
+    {
+      close();
+      return false;
+    }
+
+    sessionFd = ::open(sessionFileName.c_str(), O_RDONLY);
+    return true;
+  }
+
+  bool
+  SasChunkIndex::isOpen() const
+  {
+    return fd != -1;
+  }
+
+  void
+  SasChunkIndex::close()
+  {
+    if(fd != -1)
+      ::close(fd);
+    if(sessionFd != -1)
+      ::close(sessionFd);
+
+    fd = -1;
+    sessionFd = -1;
+    entries.clear();
+    lastCheckpoint = { 0, 0 };
+    sequence = 0;
+  }
+
+  std::size_t
+  SasChunkIndex::size() const
+  {
+    return entries.size();
+  }
+
+  const SasChunkIndex::Entry&
+  SasChunkIndex::operator [](std::size_t chunk) const
+  {
+    assert(chunk < entries.size());
+    return entries[chunk];
+  }
+
+  bool
+  SasChunkIndex::append(const Entry& entry)
+  {
+    if(fd == -1)
+      return false;
+
+    std::stringstream data;
+    {
+      Serializer<std::stringstream> serializer(data);
+      serializer << entry.firstFrame << entry.offset << entry.bytes
+                 << entry.frames << static_cast<std::uint32_t>(0);
+    }
+    const std::string entryData = data.str();
+
+    if(pwrite(fd, entryData.data(), entryData.size(),
+              headerSize + entries.size() * entrySize) != entrySize)
+      return false;
+
+    entries.push_back(entry);
+    return true;
+  }
+
+  bool
+  SasChunkIndex::truncate(std::size_t chunk)
+  {
+    if(fd == -1 or chunk > entries.size())
+      return false;
+
+    // A checkpoint past the entries left is wrong, both slots are emptied
+    if(chunk < lastCheckpoint.chunks)
+    {
+      const Checkpoint empty { 0, 0 };
+      if(not writeSlot(0, 0, empty) or not writeSlot(1, 0, empty))
+        return false;
+      lastCheckpoint = empty;
+      sequence = 0;
+    }
+
+    if(ftruncate(fd, headerSize + chunk * entrySize) != 0)
+      return false;
+
+    entries.resize(chunk);
+    return true;
+  }
+
+  bool
+  SasChunkIndex::checkpoint(std::uint64_t sasBytes, SyncPolicy policy)
+  {
+    if(fd == -1)
+      return false;
+
+    // Chunks and entries must be on disk before the checkpoint can be
+    if(policy == SyncPolicy::CHECKPOINTS and
+       (sessionFd == -1 or fdatasync(sessionFd) != 0 or fdatasync(fd) != 0))
+      return false;
+
+    // The slot of the previous checkpoint is left alone
+    const Checkpoint next { entries.size(), sasBytes };
+    if(not writeSlot((sequence + 1) % 2, sequence + 1, next))
+      return false;
+
+    sequence++;
+    lastCheckpoint = next;
+
+    if(policy == SyncPolicy::CHECKPOINTS)
+      return fdatasync(fd) == 0;
+    return true;
+  }
+
+  const SasChunkIndex::Checkpoint&
+  SasChunkIndex::getCheckpoint() const
+  {
+    return lastCheckpoint;
+  }
+
+  std::string
+  SasChunkIndex::getSidecarFileName(const std::string& sessionFileName)
+  {
+    return sessionFileName + ".pstpcix";
+  }
+
+  std::uint64_t
+  SasChunkIndex::checksum(std::uint64_t slotSequence,
+                          const Checkpoint& slotCheckpoint) const
+  {
+    // FNV-1a over the slot and the offset of the SAS stream
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    for(std::uint64_t value : { slotSequence, slotCheckpoint.chunks,
+                                slotCheckpoint.sasBytes, sasOffset })
+    {
+      for(unsigned int byte = 0; byte < 8; byte++)
+      {
+        hash ^= (value >> (byte * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
+      }
+    }
+
+    return hash;
+  }
+
+  bool
+  SasChunkIndex::writeSlot(unsigned int slot, std::uint64_t slotSequence,
+                           const Checkpoint& slotCheckpoint)
+  {
+    // An empty slot gets no checksum, so that it is never taken as valid
+    std::stringstream data;
+    {
+      Serializer<std::stringstream> serializer(data);
+      serializer << slotSequence << slotCheckpoint.chunks
+                 << slotCheckpoint.sasBytes
+                 << (slotSequence == 0 ? std::uint64_t(0) :
+                     checksum(slotSequence, slotCheckpoint));
+    }
+    const std::string slotData = data.str();
+
+    return pwrite(fd, slotData.data(), slotData.size(),
+                  prefixSize + slot * slotSize) == slotSize;
+  }
+}
@@ -0,0 +1,142 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SASCHUNKINDEX_H
+#define _SASCHUNKINDEX_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace PstpFinder
+{
+  /**
+   * @brief Where every chunk of the SAS stream of a session is
+   *
+   * Kept in session name + ".pstpcix" to resume analyses. Entries are only
+   * hints, the ones missing from the session are dropped with truncate().
+   *
+   * Checkpoints alternate between two header slots, so a crash while
+   * writing one leaves the other.
+   */
+  class SasChunkIndex
+  {
+    public:
+      struct Entry
+      {
+        // First stored frame of the chunk
+        std::uint64_t firstFrame;
+        // Position of the chunk header inside the SAS stream
+        std::uint64_t offset;
+        // Bytes of the whole chunk, header and padding included
+        std::uint64_t bytes;
+        std::uint32_t frames;
+
+        std::uint64_t endFrame() const { return firstFrame + frames; }
+        std::uint64_t endOffset() const { return offset + bytes; }
+      };
+
+      struct Checkpoint
+      {
+        // Entries, and chunks in the SAS stream, that can be trusted
+        std::uint64_t chunks;
+        // Length of the SAS stream up to the end of those chunks
+        std::uint64_t sasBytes;
+      };
+
+      enum class SyncPolicy
+      {
+        // Checkpoints survive the process, but not the machine, crashing
+        NONE,
+        // The session and the index are synced before every checkpoint
+        CHECKPOINTS
+      };
+
+      SasChunkIndex();
+      ~SasChunkIndex();
+      SasChunkIndex(const SasChunkIndex&) = delete;
+      SasChunkIndex& operator =(const SasChunkIndex&) = delete;
+
+      /**
+       * @brief Starts an empty index, replacing any other
+       * @param sasOffset Where the SAS stream starts in the session, so
+       *        that the index of another session is not taken for this
+       */
+      bool create(const std::string& sessionFileName,
+                  std::uint64_t sasOffset);
+
+      /**
+       * @brief Loads the index of a session, to append to it afterwards
+       * @return false if there is none, or it is of another session
+       */
+      bool open(const std::string& sessionFileName,
+                std::uint64_t sasOffset);
+      bool isOpen() const;
+      void close();
+
+      std::size_t size() const;
+      const Entry& operator [](std::size_t chunk) const;
+
+      /**
+       * @brief Writes an entry at the end of the file, before returning
+       */
+      bool append(const Entry& entry);
+
+      /**
+       * @brief Drops every entry from chunk on
+       */
+      bool truncate(std::size_t chunk);
+
+      /**
+       * @brief Marks every entry written so far as there to stay
+       * @param sasBytes Length of the SAS stream, already flushed
+       * @return false if it could not be made durable
+       */
+      bool checkpoint(std::uint64_t sasBytes, SyncPolicy policy);
+
+      /**
+       * @brief Last checkpoint, with no chunks when there is none
+       */
+      const Checkpoint& getCheckpoint() const;
+
+      static std::string getSidecarFileName(
+          const std::string& sessionFileName);
+
+    private:
+      int fd;
+      // Only used to sync the session file
+      int sessionFd;
+      std::uint64_t sasOffset;
+      std::vector<Entry> entries;
+      Checkpoint lastCheckpoint;
+      // Of the last checkpoint, it tells in which slot it is
+      std::uint64_t sequence;
+
+      std::uint64_t checksum(std::uint64_t slotSequence,
+                             const Checkpoint& slotCheckpoint) const;
+      bool writeSlot(unsigned int slot, std::uint64_t slotSequence,
+                     const Checkpoint& slotCheckpoint);
+  };
+}
+
+#endif /* _SASCHUNKINDEX_H */
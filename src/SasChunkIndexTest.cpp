@@ -0,0 +1,128 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasChunkIndex.h"
+#include "UnitTest.h"
+
+#include <fstream>
+#include <string>
+#include <cstdio>
+
+using namespace PstpFinder;
+using UnitTest::check;
+
+static const std::uint64_t sasOffset = 64;
+
+static SasChunkIndex::Entry
+makeEntry(unsigned int chunk)
+{
+  SasChunkIndex::Entry entry;
+  entry.firstFrame = chunk * 10;
+  entry.offset = chunk * 100;
+  entry.bytes = 100;
+  entry.frames = 10;
+  return entry;
+}
+
+static bool
+sameEntry(const SasChunkIndex::Entry& a, const SasChunkIndex::Entry& b)
+{
+  return a.firstFrame == b.firstFrame and a.offset == b.offset
+         and a.bytes == b.bytes and a.frames == b.frames;
+}
+
+/*
+ * An analysis checkpoints twice, saves one more chunk and dies: the chunk
+ * after the last checkpoint must not be trusted, the resumed analysis
+ * drops it and goes on, and a damaged checkpoint falls back to the other
+ * slot.
+ */
+static void
+testCheckpointAndResume(const std::string& sessionFileName)
+{
+  std::ofstream(sessionFileName.c_str()) << "session";
+
+  SasChunkIndex index;
+  check(index.create(sessionFileName, sasOffset), "create failed");
+  unsigned int chunk = 0;
+  for(; chunk < 3; chunk++)
+    check(index.append(makeEntry(chunk)), "append failed");
+  check(index.checkpoint(makeEntry(2).endOffset(),
+                         SasChunkIndex::SyncPolicy::NONE),
+        "first checkpoint failed");
+  for(; chunk < 5; chunk++)
+    check(index.append(makeEntry(chunk)), "append failed");
+  check(index.checkpoint(makeEntry(4).endOffset(),
+                         SasChunkIndex::SyncPolicy::NONE),
+        "second checkpoint failed");
+  check(index.append(makeEntry(chunk)), "append failed");
+  index.close();
+
+  check(index.open(sessionFileName, sasOffset), "open failed");
+  check(index.size() == 6, "entries after the checkpoint lost");
+  check(index.getCheckpoint().chunks == 5
+        and index.getCheckpoint().sasBytes == makeEntry(4).endOffset(),
+        "wrong checkpoint after open");
+  bool same = index.size() == 6;
+  for(unsigned int entry = 0; same and entry < index.size(); entry++)
+    same = sameEntry(index[entry], makeEntry(entry));
+  check(same, "entries changed after open");
+
+  // Resume from the last checkpoint
+  check(index.truncate(index.getCheckpoint().chunks), "truncate failed");
+  check(index.size() == 5, "wrong size after truncate");
+  check(index.append(makeEntry(5)), "append after resume failed");
+  check(index.checkpoint(makeEntry(5).endOffset(),
+                         SasChunkIndex::SyncPolicy::NONE),
+        "checkpoint after resume failed");
+  check(index.getCheckpoint().chunks == 6, "wrong checkpoint after resume");
+  index.close();
+
+  // Break the checksum of the newest slot, the third checkpoint is in the
+  // second one
+  {
+    std::fstream sidecar(
+        SasChunkIndex::getSidecarFileName(sessionFileName).c_str(),
+        std::ios::in | std::ios::out | std::ios::binary);
+    sidecar.seekp(16 + 32 + 24);
+    sidecar.put('\xff');
+  }
+
+  check(index.open(sessionFileName, sasOffset), "open after damage failed");
+  check(index.size() == 6, "entries lost after damage");
+  check(index.getCheckpoint().chunks == 5
+        and index.getCheckpoint().sasBytes == makeEntry(4).endOffset(),
+        "damaged checkpoint not skipped");
+  index.close();
+
+  check(not index.open(sessionFileName, sasOffset + 1),
+        "index of another session opened");
+}
+
+int
+main()
+{
+  const std::string sessionFileName("SasChunkIndexTest.pstp");
+  testCheckpointAndResume(sessionFileName);
+
+  std::remove(SasChunkIndex::getSidecarFileName(sessionFileName).c_str());
+  std::remove(sessionFileName.c_str());
+
+  return UnitTest::result();
+}
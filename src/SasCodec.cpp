@@ -0,0 +1,166 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasCodec.h"
+
+#include <cmath>
+#include <limits>
+
+namespace PstpFinder
+{
+  SasCodec::SasCodec(unsigned int nAtoms, real precision) :
+      nAtoms(nAtoms), precision(precision)
+  {
+  }
+
+  unsigned int
+  SasCodec::getAtomsCount() const
+  {
+    return nAtoms;
+  }
+
+  real
+  SasCodec::getPrecision() const
+  {
+    return precision;
+  }
+
+  static inline std::uint64_t
+  zigzag(std::int64_t value)
+  {
+    // Small differences of both signs become small unsigned values
+    const std::uint64_t magnitude = static_cast<std::uint64_t>(value);
+    return value < 0 ? (~magnitude << 1) | 1 : magnitude << 1;
+  }
+
+  static inline std::int64_t
+  unzigzag(std::uint64_t value)
+  {
+    const std::int64_t half = static_cast<std::int64_t>(value >> 1);
+    return value & 1 ? ~half : half;
+  }
+
+  void
+  SasCodec::putVarint(std::uint64_t value, std::vector<unsigned char>& data)
+  {
+    while(value >= 0x80)
+    {
+      data.push_back(static_cast<unsigned char>(value) | 0x80);
+      value >>= 7;
+    }
+    data.push_back(static_cast<unsigned char>(value));
+  }
+
+  bool
+  SasCodec::getVarint(const unsigned char*& data, const unsigned char* end,
+                      std::uint64_t& value)
+  {
+    value = 0;
+    for(unsigned int shift = 0; data < end and shift < 64; shift += 7)
+    {
+      const unsigned char byte = *data++;
+      value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      if(not (byte & 0x80))
+        return true;
+    }
+
+    return false;
+  }
+
+  void
+  SasCodec::encode(const real* sas, unsigned int nFrames,
+                   std::vector<unsigned char>& data)
+  {
+    const double inverse = 1. / precision;
+    const double limit = std::numeric_limits<std::int32_t>::max();
+    std::uint64_t zeros = 0;
+
+    data.clear();
+    previous.assign(nAtoms, 0);
+    for(unsigned int frame = 0; frame < nFrames; frame++)
+    {
+      for(unsigned int i = 0; i < nAtoms; i++)
+      {
+        const double scaled = std::fmin(std::fmax(*sas++ * inverse,
+                                                  -limit), limit);
+        const std::int64_t value = std::llround(scaled);
+        const std::int64_t delta = value - previous[i];
+        previous[i] = value;
+
+        if(delta == 0)
+        {
+          zeros++;
+          continue;
+        }
+
+        // A zero token is followed by the length of the run
+        if(zeros > 0)
+        {
+          putVarint(0, data);
+          putVarint(zeros, data);
+          zeros = 0;
+        }
+        putVarint(zigzag(delta), data);
+      }
+    }
+
+    if(zeros > 0)
+    {
+      putVarint(0, data);
+      putVarint(zeros, data);
+    }
+  }
+
+  bool
+  SasCodec::decode(const unsigned char* data, std::size_t size, real* sas,
+                   unsigned int nFrames)
+  {
+    const unsigned char* const end = data + size;
+    std::uint64_t zeros = 0;
+    std::uint64_t token;
+
+    previous.assign(nAtoms, 0);
+    for(unsigned int frame = 0; frame < nFrames; frame++)
+    {
+      for(unsigned int i = 0; i < nAtoms; i++)
+      {
+        if(zeros > 0)
+          zeros--;
+        else
+        {
+          if(not getVarint(data, end, token))
+            return false;
+
+          if(token == 0)
+          {
+            if(not getVarint(data, end, zeros) or zeros == 0)
+              return false;
+            zeros--;
+          }
+          else
+            previous[i] += unzigzag(token);
+        }
+
+        *sas++ = previous[i] * precision;
+      }
+    }
+
+    return data == end and zeros == 0;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SASCODEC_H
+#define _SASCODEC_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  /**
+   * @brief Compresses the SAS of the frames of a chunk
+   *
+   * Quantized deltas from the previous frame, as varints with zero runs.
+   * Every chunk can be decoded on its own.
+   */
+  class SasCodec
+  {
+    public:
+      SasCodec(unsigned int nAtoms = 0, real precision = 0);
+
+      unsigned int getAtomsCount() const;
+      real getPrecision() const;
+
+      /**
+       * @brief Encodes nFrames frames of SAS values one after the other
+       */
+      void encode(const real* sas, unsigned int nFrames,
+                  std::vector<unsigned char>& data);
+
+      /**
+       * @brief Decodes nFrames frames of SAS values one after the other
+       * @return false if data does not hold exactly nFrames frames
+       */
+      bool decode(const unsigned char* data, std::size_t size, real* sas,
+                  unsigned int nFrames);
+
+    private:
+      unsigned int nAtoms;
+      real precision;
+      std::vector<std::int64_t> previous;
+
+      static void putVarint(std::uint64_t value,
+                            std::vector<unsigned char>& data);
+      static bool getVarint(const unsigned char*& data,
+                            const unsigned char* end, std::uint64_t& value);
+  };
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasCodec.h"
+#include "UnitTest.h"
+
+#include <vector>
+#include <cmath>
+#include <limits>
+
+using namespace PstpFinder;
+using UnitTest::check;
+
+static const unsigned int nAtoms = 37;
+static const real precision = 0.001;
+
+/*
+ * Buried atoms are always zero, some atoms never change and the others go
+ * up and down, so there are runs of zeros and deltas of both signs.
+ */
+static std::vector<real>
+makeFrames(unsigned int nFrames)
+{
+  std::vector<real> frames(nFrames * nAtoms);
+  for(unsigned int frame = 0; frame < nFrames; frame++)
+  {
+    for(unsigned int atom = 0; atom < nAtoms; atom++)
+    {
+      real& sas = frames[frame * nAtoms + atom];
+      if(atom % 3 == 0)
+        sas = 0;
+      else if(atom % 3 == 1)
+        sas = 0.25 * atom;
+      else
+        sas = 1 + std::sin(0.7 * frame + atom);
+    }
+  }
+
+  return frames;
+}
+
+static void
+testRoundTrip()
+{
+  const unsigned int nFrames = 12;
+  std::vector<real> frames = makeFrames(nFrames);
+  std::vector<unsigned char> data;
+  SasCodec codec(nAtoms, precision);
+  codec.encode(frames.data(), nFrames, data);
+  check(not data.empty(), "round trip: nothing encoded");
+
+  std::vector<real> sas(frames.size());
+  check(codec.decode(data.data(), data.size(), sas.data(), nFrames),
+        "round trip: values not decoded");
+
+  bool exact = true;
+  for(std::size_t i = 0; i < frames.size(); i++)
+  {
+    if(std::fabs(sas[i] - frames[i]) > precision * 0.51)
+      exact = false;
+    if(frames[i] == 0 and sas[i] != 0)
+      exact = false;
+  }
+  check(exact, "round trip: values not within the precision");
+}
+
+static void
+testZeroRuns()
+{
+  // Everything is zero, a single run covers the whole chunk
+  const unsigned int nFrames = 8;
+  std::vector<real> frames(nFrames * nAtoms, 0);
+  std::vector<unsigned char> data;
+  SasCodec codec(nAtoms, precision);
+  codec.encode(frames.data(), nFrames, data);
+  check(data.size() <= 4, "zero runs: not collapsed");
+
+  std::vector<real> sas(frames.size(), 1);
+  check(codec.decode(data.data(), data.size(), sas.data(), nFrames),
+        "zero runs: not decoded");
+  bool zeros = true;
+  for(real value : sas)
+    zeros = zeros and value == 0;
+  check(zeros, "zero runs: values are not zero");
+}
+
+static void
+testClamping()
+{
+  // Values out of the quantized range are clamped, not wrapped around
+  const unsigned int nFrames = 2;
+  std::vector<real> frames(nFrames * nAtoms, 0);
+  frames[0] = 1e12;
+  frames[1] = -1e12;
+  frames[nAtoms] = -1e12;
+  frames[nAtoms + 1] = 1e12;
+  std::vector<unsigned char> data;
+  SasCodec codec(nAtoms, precision);
+  codec.encode(frames.data(), nFrames, data);
+
+  std::vector<real> sas(frames.size());
+  check(codec.decode(data.data(), data.size(), sas.data(), nFrames),
+        "clamping: not decoded");
+
+  const double limit = std::numeric_limits<std::int32_t>::max() * precision;
+  auto near = [&](real value, double expected)
+  {
+    return std::fabs(value - expected) <= std::fabs(expected) * 1e-6;
+  };
+  check(near(sas[0], limit) and near(sas[1], -limit),
+        "clamping: first frame not clamped");
+  check(near(sas[nAtoms], -limit) and near(sas[nAtoms + 1], limit),
+        "clamping: negative deltas across the range not decoded");
+}
+
+static void
+testTruncated()
+{
+  const unsigned int nFrames = 6;
+  std::vector<real> frames = makeFrames(nFrames);
+  std::vector<unsigned char> data;
+  SasCodec codec(nAtoms, precision);
+  codec.encode(frames.data(), nFrames, data);
+
+  std::vector<real> sas((nFrames + 1) * nAtoms);
+  bool rejected = true;
+  for(std::size_t size = 0; size < data.size(); size++)
+    rejected = rejected and not codec.decode(data.data(), size, sas.data(),
+                                             nFrames);
+  check(rejected, "truncated: a part of the chunk was decoded");
+
+  data.push_back(0);
+  check(not codec.decode(data.data(), data.size(), sas.data(), nFrames),
+        "truncated: trailing bytes accepted");
+  data.pop_back();
+
+  check(not codec.decode(data.data(), data.size(), sas.data(), nFrames - 1),
+        "truncated: fewer frames accepted");
+  check(not codec.decode(data.data(), data.size(), sas.data(), nFrames + 1),
+        "truncated: more frames accepted");
+}
+
+int
+main()
+{
+  testRoundTrip();
+  testZeroRuns();
+  testClamping();
+  testTruncated();
+
+  return UnitTest::result();
+}
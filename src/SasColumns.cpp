@@ -0,0 +1,298 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasColumns.h"
+#include "MappedSasStream.h"
+#include "Session.h"
+#include "Serializer.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace PstpFinder
+{
+  static constexpr std::uint32_t sidecarMagic = 0x50535043; // "PSPC"
+  static constexpr std::uint32_t sidecarVersion = 1;
+  // Magic, version, fingerprint, atoms, padding and frames
+  static constexpr std::int64_t headerSize = 32;
+  // Bytes of the session read at each end of the SAS stream to tell it
+  static constexpr std::int64_t fingerprintBytes = 65536;
+  // Frames transposed at once take about this much memory
+  static constexpr std::int64_t blockBytes = 64l << 20;
+
+  SasColumns::SasColumns() :
+      fd(-1), data(nullptr), length(0), nAtoms(0), nFrames(0)
+  {
+  }
+
+  SasColumns::~SasColumns()
+  {
+    unmap();
+  }
+
+  bool
+  SasColumns::load(const std::string& sessionFileName, unsigned int nAtoms)
+  {
+    std::uint64_t value;
+    unmap();
+    if(nAtoms == 0 or not fingerprint(sessionFileName, value))
+      return false;
+
+    const std::string sidecar = getSidecarFileName(sessionFileName);
+    if(map(sidecar, value, nAtoms))
+      return true;
+
+    if(not build(sessionFileName, sidecar, value, nAtoms))
+      return false;
+
+    return map(sidecar, value, nAtoms);
+  }
+
+  bool
+  SasColumns::isLoaded() const
+  {
+    return data != nullptr;
+  }
+
+  unsigned int
+  SasColumns::getAtomsCount() const
+  {
+    return nAtoms;
+  }
+
+  unsigned long
+  SasColumns::getFramesCount() const
+  {
+    return nFrames;
+  }
+
+  const float*
+  SasColumns::column(unsigned int atom) const
+  {
+    return reinterpret_cast<const float*>(data + headerSize)
+           + static_cast<std::size_t>(atom) * nFrames;
+  }
+
+  std::string
+  SasColumns::getSidecarFileName(const std::string& sessionFileName)
+  {
+    return sessionFileName + ".pstpcol";
+  }
+
+  bool
+  SasColumns::fingerprint(const std::string& sessionFileName,
+                          std::uint64_t& value)
+  {
+    std::int64_t offset, size;
+    {
+      Session<std::ifstream> session(sessionFileName);
+      if(not session.sasComplete())
+        return false;
+
+      offset = session.getSasOffset();
+      size = session.getSasSize();
+    }
+
+    std::ifstream stream(sessionFileName,
+                         std::ios_base::in | std::ios_base::binary);
+    if(not stream)
+      return false;
+
+    // FNV-1a of position and size of the stream, and of its ends
+    const std::int64_t ends = std::min(size, fingerprintBytes);
+    std::vector<char> bytes(ends * 2);
+    stream.seekg(offset);
+    stream.read(bytes.data(), ends);
+    stream.seekg(offset + size - ends);
+    stream.read(bytes.data() + ends, ends);
+    if(not stream)
+      return false;
+
+    value = 14695981039346656037ull;
+    auto hash = [&](unsigned char byte)
+    {
+      value = (value ^ byte) * 1099511628211ull;
+    };
+    for(unsigned int shift = 0; shift < 64; shift += 8)
+    {
+      hash(static_cast<std::uint64_t>(offset) >> shift);
+      hash(static_cast<std::uint64_t>(size) >> shift);
+    }
+    for(char byte : bytes)
+      hash(byte);
+
+    return true;
+  }
+
+  bool
+  SasColumns::map(const std::string& fileName, std::uint64_t fingerprint,
+                  unsigned int atoms)
+  {
+    {
+      std::ifstream stream(fileName,
+                           std::ios_base::in | std::ios_base::binary);
+      if(not stream)
+        return false;
+
+      Serializer<std::ifstream> serializer(stream);
+      std::uint32_t magic, version, storedAtoms, padding;
+      std::uint64_t storedFingerprint, frames;
+      serializer >> magic >> version >> storedFingerprint >> storedAtoms
+                 >> padding >> frames;
+      if(not stream or magic != sidecarMagic or version != sidecarVersion
+         or storedFingerprint != fingerprint or storedAtoms != atoms)
+        return false;
+
+      nFrames = frames;
+    }
+
+    struct stat info;
+    fd = open(fileName.c_str(), O_RDONLY);
+    if(fd == -1)
+      return false;
+
+    const std::int64_t expected = headerSize + static_cast<std::int64_t>(
+        atoms) * nFrames * sizeof(float);
+    if(fstat(fd, &info) != 0 or info.st_size != expected)
+    {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED)
+    {
+      close(fd);
+      fd = -1;
+      return false;
+    }
+
+    // Columns are read selectively, readahead would touch the others
+    madvise(mapping, info.st_size, MADV_RANDOM);
+    data = static_cast<const unsigned char*>(mapping);
+    length = info.st_size;
+    nAtoms = atoms;
+    return true;
+  }
+
+  void
+  SasColumns::unmap()
+  {
+    if(data)
+      munmap(const_cast<unsigned char*>(data), length);
+    if(fd != -1)
+      close(fd);
+
+    fd = -1;
+    data = nullptr;
+    length = 0;
+    nAtoms = 0;
+    nFrames = 0;
+  }
+
+  bool
+  SasColumns::build(const std::string& sessionFileName,
+                    const std::string& fileName, std::uint64_t fingerprint,
+                    unsigned int atoms)
+  {
+    MappedSasStream sasStream(sessionFileName, atoms);
+    if(not sasStream.isOpen())
+      return false;
+
+    // Columns of a damaged stream would silently miss frames
+    const std::uint64_t frames = sasStream.countFrames();
+    if(frames == 0 or sasStream.isDamaged())
+      return false;
+
+    std::stringstream header;
+    {
+      Serializer<std::stringstream> serializer(header);
+      serializer << sidecarMagic << sidecarVersion << fingerprint << atoms
+                 << static_cast<std::uint32_t>(0) << frames;
+    }
+    const std::string headerData = header.str();
+
+    // Written aside and renamed, a reader never sees partial columns
+    const std::string temporary = fileName + ".tmp";
+    const int out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                         0644);
+    if(out == -1)
+      return false;
+
+    const std::int64_t columnBytes = frames * sizeof(float);
+    bool written = pwrite(out, headerData.data(), headerData.size(), 0)
+                   == headerSize
+                   and ftruncate(out, headerSize + atoms * columnBytes) == 0;
+
+    /*
+     * A block of frames is transposed in memory, then every atom gets its
+     * part of the block with a single write at its place in the column.
+     */
+    const std::uint64_t blockFrames = std::max<std::int64_t>(
+        1, blockBytes / (static_cast<std::int64_t>(atoms) * sizeof(float)));
+    std::vector<float> block(blockFrames * atoms);
+    std::uint64_t firstFrame = 0;
+    SasSpan frame;
+
+    while(written and firstFrame < frames)
+    {
+      const std::uint64_t count = std::min(blockFrames, frames - firstFrame);
+      for(std::uint64_t k = 0; k < count; k++)
+      {
+        if(not sasStream.next(frame))
+        {
+          written = false;
+          break;
+        }
+
+        for(unsigned int atom = 0; atom < atoms; atom++)
+          block[atom * count + k] = frame[atom];
+      }
+
+      for(unsigned int atom = 0; written and atom < atoms; atom++)
+      {
+        const std::int64_t bytes = count * sizeof(float);
+        written = pwrite(out, block.data() + atom * count, bytes,
+                         headerSize + atom * columnBytes
+                         + firstFrame * sizeof(float)) == bytes;
+      }
+
+      firstFrame += count;
+    }
+
+    if(close(out) != 0)
+      written = false;
+
+    if(not written or std::rename(temporary.c_str(), fileName.c_str()) != 0)
+    {
+      std::remove(temporary.c_str());
+      return false;
+    }
+
+    return true;
+  }
+}
@@ -0,0 +1,83 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SASCOLUMNS_H
+#define _SASCOLUMNS_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string>
+#include <cstdint>
+
+namespace PstpFinder
+{
+  /**
+   * @brief SAS of a session stored atom by atom
+   *
+   * Transposed from the MappedSasStream once, and cached in session name +
+   * ".pstpcol".
+   */
+  class SasColumns
+  {
+    public:
+      SasColumns();
+      ~SasColumns();
+      SasColumns(const SasColumns&) = delete;
+      SasColumns& operator =(const SasColumns&) = delete;
+
+      /**
+       * @brief Maps the columns of a complete session, building them first
+       *        when needed
+       * @return false if the SAS stream of the session can't be mapped
+       */
+      bool load(const std::string& sessionFileName, unsigned int nAtoms);
+      bool isLoaded() const;
+
+      unsigned int getAtomsCount() const;
+      unsigned long getFramesCount() const;
+
+      /**
+       * @brief SAS of atom for every stored frame
+       */
+      const float* column(unsigned int atom) const;
+
+      static std::string getSidecarFileName(
+          const std::string& sessionFileName);
+
+    private:
+      int fd;
+      const unsigned char* data;
+      std::int64_t length;
+      unsigned int nAtoms;
+      unsigned long nFrames;
+
+      bool map(const std::string& fileName, std::uint64_t fingerprint,
+               unsigned int atoms);
+      static bool build(const std::string& sessionFileName,
+                        const std::string& fileName,
+                        std::uint64_t fingerprint, unsigned int atoms);
+      static bool fingerprint(const std::string& sessionFileName,
+                              std::uint64_t& value);
+      void unmap();
+  };
+}
+
+#endif /* _SASCOLUMNS_H */
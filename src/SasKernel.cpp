@@ -0,0 +1,199 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SasKernel.h"
+
+/*
+ * Vector kernels are only built for single precision GROMACS on x86 with a
+ * compiler supporting per-function targets. They are selected at runtime,
+ * so the binary still runs on CPUs without AVX.
+ */
+#if not defined(GMX_DOUBLE) and defined(__GNUC__) and \
+    (defined(__x86_64__) or defined(__i386__))
+#define PSTPFINDER_SAS_SIMD
+#include <immintrin.h>
+#endif
+
+namespace PstpFinder
+{
+  static unsigned int
+  sasKernelScalar(const real* dotX, const real* dotY, const real* dotZ,
+                  unsigned int nDots, real radius, const real* neighbourX,
+                  const real* neighbourY, const real* neighbourZ,
+                  const real* neighbourR2, unsigned int nNeighbours)
+  {
+    unsigned int freeDots = 0;
+    unsigned int lastBuried = 0;
+
+    for(unsigned int k = 0; k < nDots; k++)
+    {
+      const real px = dotX[k] * radius;
+      const real py = dotY[k] * radius;
+      const real pz = dotZ[k] * radius;
+      bool buried = false;
+
+      // Near dots are often buried by the same neighbour: check it first
+      for(unsigned int n = 0; n < nNeighbours; n++)
+      {
+        unsigned int j = lastBuried + n;
+        if(j >= nNeighbours)
+          j -= nNeighbours;
+
+        const real dx = px - neighbourX[j];
+        const real dy = py - neighbourY[j];
+        const real dz = pz - neighbourZ[j];
+        if(dx * dx + dy * dy + dz * dz < neighbourR2[j])
+        {
+          buried = true;
+          lastBuried = j;
+          break;
+        }
+      }
+
+      if(not buried)
+        freeDots++;
+    }
+
+    return freeDots;
+  }
+
+#ifdef PSTPFINDER_SAS_SIMD
+  __attribute__((target("avx2"))) static unsigned int
+  sasKernelAvx2(const real* dotX, const real* dotY, const real* dotZ,
+                unsigned int nDots, real radius, const real* neighbourX,
+                const real* neighbourY, const real* neighbourZ,
+                const real* neighbourR2, unsigned int nNeighbours)
+  {
+    const __m256 r = _mm256_set1_ps(radius);
+    unsigned int freeDots = 0;
+
+    for(unsigned int k = 0; k < nDots; k += 8)
+    {
+      const __m256 px = _mm256_mul_ps(_mm256_loadu_ps(dotX + k), r);
+      const __m256 py = _mm256_mul_ps(_mm256_loadu_ps(dotY + k), r);
+      const __m256 pz = _mm256_mul_ps(_mm256_loadu_ps(dotZ + k), r);
+      const unsigned int lanes = nDots - k < 8 ? nDots - k : 8;
+      const int valid = (1 << lanes) - 1;
+      int buried = 0;
+
+      for(unsigned int j = 0; j < nNeighbours and buried != valid; j++)
+      {
+        const __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(neighbourX[j]));
+        const __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(neighbourY[j]));
+        const __m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(neighbourZ[j]));
+        const __m256 d2 = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+            _mm256_mul_ps(dz, dz));
+        const __m256 inside = _mm256_cmp_ps(d2,
+                                            _mm256_set1_ps(neighbourR2[j]),
+                                            _CMP_LT_OQ);
+        buried |= _mm256_movemask_ps(inside) & valid;
+      }
+
+      freeDots += lanes - __builtin_popcount(buried);
+    }
+
+    return freeDots;
+  }
+
+  __attribute__((target("avx512f"))) static unsigned int
+  sasKernelAvx512(const real* dotX, const real* dotY, const real* dotZ,
+                  unsigned int nDots, real radius, const real* neighbourX,
+                  const real* neighbourY, const real* neighbourZ,
+                  const real* neighbourR2, unsigned int nNeighbours)
+  {
+    const __m512 r = _mm512_set1_ps(radius);
+    unsigned int freeDots = 0;
+
+    for(unsigned int k = 0; k < nDots; k += 16)
+    {
+      const __m512 px = _mm512_mul_ps(_mm512_loadu_ps(dotX + k), r);
+      const __m512 py = _mm512_mul_ps(_mm512_loadu_ps(dotY + k), r);
+      const __m512 pz = _mm512_mul_ps(_mm512_loadu_ps(dotZ + k), r);
+      const unsigned int lanes = nDots - k < 16 ? nDots - k : 16;
+      const __mmask16 valid = (1u << lanes) - 1;
+      __mmask16 buried = 0;
+
+      for(unsigned int j = 0; j < nNeighbours and buried != valid; j++)
+      {
+        const __m512 dx = _mm512_sub_ps(px, _mm512_set1_ps(neighbourX[j]));
+        const __m512 dy = _mm512_sub_ps(py, _mm512_set1_ps(neighbourY[j]));
+        const __m512 dz = _mm512_sub_ps(pz, _mm512_set1_ps(neighbourZ[j]));
+        const __m512 d2 = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+            _mm512_mul_ps(dz, dz));
+        buried |= _mm512_mask_cmp_ps_mask(valid, d2,
+                                          _mm512_set1_ps(neighbourR2[j]),
+                                          _CMP_LT_OQ);
+      }
+
+      freeDots += lanes - __builtin_popcount(buried);
+    }
+
+    return freeDots;
+  }
+#endif
+
+  SasKernelType
+  getSasKernelType()
+  {
+#ifdef PSTPFINDER_SAS_SIMD
+    static const SasKernelType type = []()
+    {
+      __builtin_cpu_init();
+      if(__builtin_cpu_supports("avx512f"))
+        return SasKernelType::AVX512;
+      else if(__builtin_cpu_supports("avx2"))
+        return SasKernelType::AVX2;
+      else
+        return SasKernelType::SCALAR;
+    }();
+
+    return type;
+#else
+    return SasKernelType::SCALAR;
+#endif
+  }
+
+  SasKernel
+  getSasKernel(SasKernelType type)
+  {
+    // Never hand out a kernel the CPU can't run
+    if(type > getSasKernelType())
+      type = getSasKernelType();
+
+    switch(type)
+    {
+#ifdef PSTPFINDER_SAS_SIMD
+      case SasKernelType::AVX512:
+        return sasKernelAvx512;
+      case SasKernelType::AVX2:
+        return sasKernelAvx2;
+#endif
+      default:
+        return sasKernelScalar;
+    }
+  }
+
+  SasKernel
+  getSasKernel()
+  {
+    return getSasKernel(getSasKernelType());
+  }
+}
@@ -0,0 +1,71 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SASKERNEL_H
+#define _SASKERNEL_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  /**
+   * @brief Dot arrays passed to the kernels must be padded to this size
+   */
+  constexpr unsigned int SAS_KERNEL_DOTS_ALIGN = 16;
+
+  enum class SasKernelType
+  {
+    SCALAR,
+    AVX2,
+    AVX512
+  };
+
+  /**
+   * @brief Counts the dots of a sphere not buried by any neighbour
+   *
+   * Dots are on the unit sphere, neighbours are relative to its center.
+   */
+  typedef unsigned int (*SasKernel)(const real* dotX, const real* dotY,
+                                    const real* dotZ, unsigned int nDots,
+                                    real radius, const real* neighbourX,
+                                    const real* neighbourY,
+                                    const real* neighbourZ,
+                                    const real* neighbourR2,
+                                    unsigned int nNeighbours);
+
+  /**
+   * @brief Returns the fastest kernel supported by the running CPU
+   */
+  SasKernel getSasKernel();
+  SasKernel getSasKernel(SasKernelType type);
+  SasKernelType getSasKernelType();
+}
+
+#endif /* _SASKERNEL_H */
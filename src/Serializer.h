@@ -35,6 +35,7 @@
 #include <algorithm>
 #include <vector>
 #include <sstream>
+#include <cstddef>
 
 namespace PstpFinder
 {
@@ -84,6 +85,76 @@ namespace PstpFinder
       SerializerHelper(Stream& stream) :
         stream(stream) {}
 
+#ifdef PSTPFINDER_BIG_ENDIAN
+      /*
+       * Reverses the bytes of every value. The inner loop has a fixed
+       * length, so the compiler can vectorize the whole pass.
+       */
+      template<std::size_t Size>
+      static void
+      swapBytes(char_type* data, std::size_t count)
+      {
+        for(std::size_t value = 0; value < count; value++, data += Size)
+        {
+          for(std::size_t byte = 0; byte < Size / 2; byte++)
+            std::swap(data[byte], data[Size - 1 - byte]);
+        }
+      }
+#endif
+
+      /*
+       * Arrays are written and read with a single stream call, the same
+       * bytes as count calls to serializeData.
+       */
+      template<typename Serializable>
+      typename std::enable_if<std::is_arithmetic<Serializable>::value,
+        const SerializerHelper&>::type
+      serializeArray(const Serializable* data, std::size_t count) const
+      {
+#ifdef PSTPFINDER_BIG_ENDIAN // Default little endian
+        // Values are swapped in blocks, data itself is left untouched
+        const std::size_t blockValues = 65536 / sizeof(Serializable) + 1;
+        std::vector<char_type> buffer(
+            std::min(count, blockValues) * sizeof(Serializable));
+
+        while(count > 0)
+        {
+          const std::size_t values = std::min(count, blockValues);
+          const char_type* bytes = reinterpret_cast<const char_type*>(data);
+          std::copy(bytes, bytes + values * sizeof(Serializable),
+                    buffer.data());
+          swapBytes<sizeof(Serializable)>(buffer.data(), values);
+          stream.write(buffer.data(), values * sizeof(Serializable));
+
+          data += values;
+          count -= values;
+        }
+#else
+        stream.write(reinterpret_cast<const char_type*>(data),
+                     count * sizeof(Serializable));
+#endif
+
+        return *this;
+      }
+
+      template<typename Serializable>
+      typename std::enable_if<std::is_arithmetic<Serializable>::value,
+        bool>::type
+      deserializeArray(Serializable* data, std::size_t count) const
+      {
+        const std::streamsize bytes = count * sizeof(Serializable);
+        stream.read(reinterpret_cast<char_type*>(data), bytes);
+        if(stream.gcount() != bytes)
+          return false;
+
+#ifdef PSTPFINDER_BIG_ENDIAN // Default little endian
+        swapBytes<sizeof(Serializable)>(reinterpret_cast<char_type*>(data),
+                                        count);
+#endif
+
+        return true;
+      }
+
       template<typename Serializable>
       typename std::enable_if<std::is_arithmetic<Serializable>::value,
         const SerializerHelper&>::type
@@ -97,7 +168,7 @@ namespace PstpFinder
           *byte = *pointer;
 
 #ifdef PSTPFINDER_BIG_ENDIAN // Default little endian
-        reverse(std::begin(buffer), std::end(buffer));
+        std::reverse(std::begin(buffer), std::end(buffer));
 #endif
         stream.write(buffer.data(), sizeof(Serializable));
 
@@ -144,7 +215,7 @@ namespace PstpFinder
         char_type* pointer(reinterpret_cast<char_type*>(&serializable));
 
 #ifdef PSTPFINDER_BIG_ENDIAN // Default little endian
-        reverse(std::begin(buffer), std::end(buffer));
+        std::reverse(std::begin(buffer), std::end(buffer));
 #endif
 
         for(auto byte(std::begin(buffer)); byte < std::end(buffer);
@@ -265,6 +336,17 @@ namespace PstpFinder
         *this & output;
         return *this;
       }
+
+      /**
+       * @brief Reads count arithmetic values with a single stream call
+       * @return false if the stream ends before count values
+       */
+      template<typename Output>
+      bool
+      readArray(Output* output, std::size_t count) const
+      {
+        return SerializerHelper<Stream>::deserializeArray(output, count);
+      }
   };
 
   template<typename Stream>
@@ -317,6 +399,17 @@ namespace PstpFinder
         *this & input;
         return *this;
       }
+
+      /**
+       * @brief Writes count arithmetic values with a single stream call
+       */
+      template<typename Input>
+      const Serializer&
+      writeArray(const Input* input, std::size_t count) const
+      {
+        SerializerHelper<Stream>::serializeArray(input, count);
+        return *this;
+      }
   };
 
   template<typename Stream>
@@ -400,6 +493,28 @@ namespace PstpFinder
         return *this;
       }
 
+      /**
+       * @brief Writes count arithmetic values with a single stream call
+       */
+      template<typename Input>
+      const Serializer&
+      writeArray(const Input* input, std::size_t count) const
+      {
+        SerializerHelper<Stream>::serializeArray(input, count);
+        return *this;
+      }
+
+      /**
+       * @brief Reads count arithmetic values with a single stream call
+       * @return false if the stream ends before count values
+       */
+      template<typename Output>
+      bool
+      readArray(Output* output, std::size_t count) const
+      {
+        return SerializerHelper<Stream>::deserializeArray(output, count);
+      }
+
     private:
       enum class Mode
       {
@@ -20,7 +20,8 @@
 #ifndef SESSION_H_
 #define SESSION_H_
 
-#define SESSION_VERSION 2
+#define SESSION_VERSION 3
+#define SESSION_SAS_PRECISION 0.0001
 namespace PstpFinder
 {
   // Session forward declarations for Gromacs.h (and maybe others)
@@ -52,7 +53,16 @@ namespace PstpFinder
     BEGIN,
     END,
     RADIUS,
-    THRESHOLD
+    THRESHOLD,
+    SAS_DOTS,
+    SAS_ADAPTIVE,
+    SAS_STRIDE,
+    SAS_COMPACT,
+    SAS_PRECISION,
+    SAS_LEGACY,
+    SAS_INCREMENTAL,
+    SAS_NEIGHBOURHOOD,
+    SAS_NEIGHBOURHOOD_CUTOFF
   };
 
   // FIXME: I'd like to use a union, but std::std::string has non trivial
@@ -94,12 +104,53 @@ namespace PstpFinder
     public:
       typedef MetaStream<T> stream_type;
       Session_Base& operator =(const Session_Base&) = delete;
+      std::string getFileName() const;
       std::string getTrajectoryFileName() const;
       std::string getTopologyFileName() const;
       unsigned long getBeginTime() const;
       unsigned long getEndTime() const;
       double getRadius() const;
       double getPocketThreshold() const;
+
+      /*
+       * SAS options are stored since version 3, older sessions get the ones
+       * they were calculated with: nsc_dclm_pbc with 24 dots on every frame.
+       */
+      unsigned long getSasDots() const;
+      bool isSasAdaptive() const;
+      unsigned long getSasStride() const;
+
+      /**
+       * @brief SAS stream stores only the SAS of every atom, not SasAtom
+       */
+      bool isSasCompact() const;
+
+      /**
+       * @brief Precision of the compressed SAS stream in nm^2, 0 if raw
+       */
+      double getSasPrecision() const;
+
+      /**
+       * @brief SAS stream and values can be used from a mapping of the file
+       */
+      bool isSasAligned() const;
+
+      /**
+       * @brief SAS was calculated by nsc_dclm_pbc instead of SasCalculator
+       */
+      bool isSasLegacy() const;
+      bool isSasIncremental() const;
+
+      /**
+       * @brief SAS was calculated on the protein neighbourhood only
+       */
+      bool isSasNeighbourhood() const;
+      double getSasNeighbourhoodCutoff() const;
+
+      /**
+       * @brief Position of the SAS stream in the session file
+       */
+      unsigned long getSasOffset() const;
       stream_type& getSasStream();
       unsigned long getSasSize() const;
       bool sasComplete() const;
@@ -124,7 +175,16 @@ namespace PstpFinder
       unsigned long endTime;
       double radius;
       double pocketThreshold;
-      std::bitset<6> parameterSet;
+      unsigned long sasDots;
+      bool sasAdaptive;
+      unsigned long sasStride;
+      bool sasCompact;
+      double sasPrecision;
+      bool sasLegacy;
+      bool sasIncremental;
+      bool sasNeighbourhood;
+      double sasNeighbourhoodCutoff;
+      std::bitset<15> parameterSet;
 
       Session_Base();
       Session_Base(const std::string& fileName);
@@ -138,6 +198,7 @@ namespace PstpFinder
       inline void assertBaseIStream() const;
       inline void assertBaseOStream() const;
       inline void assertBaseIOStream() const;
+      static std::streamoff headerPadding(std::streamoff position);
 
     private:
       struct MetaData
@@ -234,10 +295,53 @@ namespace PstpFinder
           pocketThreshold = std::get<1>(parameter).dbl;
           parameterSet |= 32;
           break;
+        case SessionParameter::SAS_DOTS:
+          sasDots = std::get<1>(parameter).ulong;
+          parameterSet |= 64;
+          break;
+        case SessionParameter::SAS_ADAPTIVE:
+          sasAdaptive = std::get<1>(parameter).ulong != 0;
+          parameterSet |= 128;
+          break;
+        case SessionParameter::SAS_STRIDE:
+          sasStride = std::get<1>(parameter).ulong;
+          parameterSet |= 256;
+          break;
+        case SessionParameter::SAS_COMPACT:
+          sasCompact = std::get<1>(parameter).ulong != 0;
+          parameterSet |= 512;
+          break;
+        case SessionParameter::SAS_PRECISION:
+          sasPrecision = std::get<1>(parameter).dbl;
+          parameterSet |= 1024;
+          break;
+        case SessionParameter::SAS_LEGACY:
+          sasLegacy = std::get<1>(parameter).ulong != 0;
+          parameterSet |= 2048;
+          break;
+        case SessionParameter::SAS_INCREMENTAL:
+          sasIncremental = std::get<1>(parameter).ulong != 0;
+          parameterSet |= 4096;
+          break;
+        case SessionParameter::SAS_NEIGHBOURHOOD:
+          sasNeighbourhood = std::get<1>(parameter).ulong != 0;
+          parameterSet |= 8192;
+          break;
+        case SessionParameter::SAS_NEIGHBOURHOOD_CUTOFF:
+          sasNeighbourhoodCutoff = std::get<1>(parameter).dbl;
+          parameterSet |= 16384;
+          break;
       }
     }
   }
 
+  template<typename T>
+  std::string
+  Session_Base<T>::getFileName() const
+  {
+    return sessionFileName;
+  }
+
   template<typename T>
   std::string
   Session_Base<T>::getTrajectoryFileName() const
@@ -286,6 +390,104 @@ namespace PstpFinder
     return pocketThreshold;
   }
 
+  template<typename T>
+  unsigned long
+  Session_Base<T>::getSasDots() const
+  {
+    assert(ready);
+    return sasDots;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasAdaptive() const
+  {
+    assert(ready);
+    return sasAdaptive;
+  }
+
+  template<typename T>
+  unsigned long
+  Session_Base<T>::getSasStride() const
+  {
+    assert(ready);
+    return sasStride;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasCompact() const
+  {
+    assert(ready);
+    return sasCompact;
+  }
+
+  template<typename T>
+  double
+  Session_Base<T>::getSasPrecision() const
+  {
+    assert(ready);
+    return sasPrecision;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasAligned() const
+  {
+    assert(ready);
+    return version > 2;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasLegacy() const
+  {
+    assert(ready);
+    return sasLegacy;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasIncremental() const
+  {
+    assert(ready);
+    return sasIncremental;
+  }
+
+  template<typename T>
+  bool
+  Session_Base<T>::isSasNeighbourhood() const
+  {
+    assert(ready);
+    return sasNeighbourhood;
+  }
+
+  template<typename T>
+  double
+  Session_Base<T>::getSasNeighbourhoodCutoff() const
+  {
+    assert(ready);
+    return sasNeighbourhoodCutoff;
+  }
+
+  template<typename T>
+  unsigned long
+  Session_Base<T>::getSasOffset() const
+  {
+    assert(ready);
+    return metaSas.start;
+  }
+
+  template<typename T>
+  std::streamoff
+  Session_Base<T>::headerPadding(std::streamoff position)
+  {
+    // Bytes before the offset of the SAS stream, so that the stream is
+    // aligned to 8 bytes
+    const std::streamoff start = position + sizeof(std::streamoff);
+    return (8 - start % 8) % 8;
+  }
+
   template<typename T>
   typename Session_Base<T>::stream_type&
   Session_Base<T>::getSasStream()
@@ -396,6 +598,33 @@ namespace PstpFinder
     *serializer >> endTime;
     *serializer >> radius;
     *serializer >> pocketThreshold;
+    if(version > 2)
+    {
+      *serializer >> sasDots;
+      *serializer >> sasAdaptive;
+      *serializer >> sasStride;
+      *serializer >> sasCompact;
+      *serializer >> sasPrecision;
+      *serializer >> sasLegacy;
+      *serializer >> sasIncremental;
+      *serializer >> sasNeighbourhood;
+      *serializer >> sasNeighbourhoodCutoff;
+      sessionFile->seekg(headerPadding(sessionFile->tellg()),
+                         std::ios_base::cur);
+    }
+    else
+    {
+      // Older sessions were always calculated by nsc_dclm_pbc with 24 dots
+      sasDots = 24;
+      sasAdaptive = false;
+      sasStride = 1;
+      sasCompact = false;
+      sasPrecision = 0;
+      sasLegacy = true;
+      sasIncremental = false;
+      sasNeighbourhood = false;
+      sasNeighbourhoodCutoff = 0;
+    }
 
     parameterSet.set();
 
@@ -532,7 +761,7 @@ namespace PstpFinder
   void
   Session_Base<T>::prepareForWrite()
   {
-    assert(parameterSet.all()); // Has radius and pocketThreshold set
+    assert(parameterSet.all()); // Has radius, pocketThreshold and SAS dots set
 
     std::streamoff offset;
     switch(version)
@@ -546,6 +775,18 @@ namespace PstpFinder
         *serializer << endTime;
         *serializer << radius;
         *serializer << pocketThreshold;
+        *serializer << sasDots;
+        *serializer << sasAdaptive;
+        *serializer << sasStride;
+        *serializer << sasCompact;
+        *serializer << sasPrecision;
+        *serializer << sasLegacy;
+        *serializer << sasIncremental;
+        *serializer << sasNeighbourhood;
+        *serializer << sasNeighbourhoodCutoff;
+        for(std::streamoff padding = headerPadding(sessionFile->tellp());
+            padding > 0; padding--)
+          sessionFile->put(0);
 
         metaSas.info = sessionFile->tellp();
         metaPdb.info = -1;
@@ -564,6 +805,7 @@ namespace PstpFinder
         break;
       case 1:  // SAS + PDB
       case 2:  // SAS + PDB + Pittpi
+      case 3:  // SAS + PDB + Pittpi, with SAS options and aligned SAS
         if(metaSas.end == 0)
         {
           metaSas.complete = false;
@@ -589,7 +831,7 @@ namespace PstpFinder
           metaPdb.stream->callbackClose = std::bind(
               &Session_Base<T>::eventPdbStreamClosing, std::ref(*this));
         }
-        else if(version == 2 and metaPittpi.end == 0)
+        else if(version > 1 and metaPittpi.end == 0)
         {
           metaSas.complete = true;
           metaPdb.complete = true;
@@ -768,7 +1010,8 @@ namespace PstpFinder
     public:
       Session() : Base() {}
       Session(const std::string& fileName, Gromacs& gromacs, double radius,
-              double pocketThreshold) :
+              double pocketThreshold, bool sasCompact = false,
+              double sasPrecision = SESSION_SAS_PRECISION) :
           Base(fileName,
                 { make_sessionParameter(SessionParameter::TRAJECTORY,
                                         gromacs.getTrajectoryFile()),
@@ -782,7 +1025,34 @@ namespace PstpFinder
                       static_cast<unsigned long>(gromacs.getEnd())),
                   make_sessionParameter(SessionParameter::RADIUS, radius),
                   make_sessionParameter(SessionParameter::THRESHOLD,
-                                        pocketThreshold) })
+                                        pocketThreshold),
+                  make_sessionParameter(
+                      SessionParameter::SAS_DOTS,
+                      static_cast<unsigned long>(gromacs.sasDots())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_ADAPTIVE,
+                      static_cast<unsigned long>(gromacs.adaptiveSas())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_STRIDE,
+                      static_cast<unsigned long>(gromacs.sasStride())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_COMPACT,
+                      static_cast<unsigned long>(sasCompact)),
+                  // Only compact streams can be compressed
+                  make_sessionParameter(SessionParameter::SAS_PRECISION,
+                                        sasCompact ? sasPrecision : 0.),
+                  make_sessionParameter(
+                      SessionParameter::SAS_LEGACY,
+                      static_cast<unsigned long>(gromacs.useLegacySas())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_INCREMENTAL,
+                      static_cast<unsigned long>(gromacs.incrementalSas())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_NEIGHBOURHOOD,
+                      static_cast<unsigned long>(gromacs.compactSas())),
+                  make_sessionParameter(
+                      SessionParameter::SAS_NEIGHBOURHOOD_CUTOFF,
+                      static_cast<double>(gromacs.compactSasCutoff())) })
       {
         Base::assertBaseOStream();
         Base::prepareForWrite();
@@ -0,0 +1,241 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SPSCRING_H
+#define _SPSCRING_H
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace PstpFinder
+{
+  /**
+   * @brief A lock-free ring of reused slots, one producer and one consumer
+   *
+   * The producer fills back() and push()es it, the consumer uses front() and
+   * pop()s it. Only threads that have to wait take a mutex.
+   */
+  template<typename T>
+  class SpscRing
+  {
+    public:
+      SpscRing(std::size_t capacity);
+      SpscRing(const SpscRing&) = delete;
+      SpscRing& operator =(const SpscRing&) = delete;
+
+      std::size_t capacity() const;
+      bool empty() const;
+      bool full() const;
+
+      // Producer side
+      std::size_t depth() const;
+      void setDepth(std::size_t depth);
+      T& back();
+      void push();
+
+      /**
+       * @brief Waits for a free slot
+       * @return false if the ring has been closed
+       */
+      bool waitNotFull();
+
+      /**
+       * @brief Waits until the consumer has given back every slot
+       */
+      void waitEmpty();
+
+      // Consumer side
+      T& front();
+      void pop();
+
+      /**
+       * @brief Waits for a published slot
+       * @return false if the ring is closed and empty
+       */
+      bool waitNotEmpty();
+
+      void close();
+      bool isClosed() const;
+
+    private:
+      std::vector<T> slots;
+      // Used only by the producer
+      std::size_t usedSlots;
+      // Written only by the consumer and by the producer respectively
+      std::atomic<std::size_t> head;
+      std::atomic<std::size_t> tail;
+      std::atomic<bool> closed;
+      std::atomic<unsigned int> waiters;
+      std::mutex waitMutex;
+      std::condition_variable waitCondition;
+
+      void notify();
+      template<typename Predicate>
+      void wait(Predicate predicate);
+  };
+
+  template<typename T>
+  SpscRing<T>::SpscRing(std::size_t capacity) :
+      slots(capacity > 0 ? capacity : 1), usedSlots(slots.size()), head(0),
+      tail(0), closed(false), waiters(0)
+  {
+  }
+
+  template<typename T>
+  std::size_t
+  SpscRing<T>::capacity() const
+  {
+    return slots.size();
+  }
+
+  template<typename T>
+  bool
+  SpscRing<T>::empty() const
+  {
+    return head.load() == tail.load();
+  }
+
+  template<typename T>
+  bool
+  SpscRing<T>::full() const
+  {
+    return tail.load() - head.load() >= usedSlots;
+  }
+
+  template<typename T>
+  std::size_t
+  SpscRing<T>::depth() const
+  {
+    return usedSlots;
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::setDepth(std::size_t depth)
+  {
+    // Slots already pending beyond the new depth are saved as usual
+    usedSlots = std::max<std::size_t>(std::min(depth, slots.size()), 1);
+  }
+
+  template<typename T>
+  T&
+  SpscRing<T>::back()
+  {
+    return slots[tail.load(std::memory_order_relaxed) % slots.size()];
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::push()
+  {
+    // Sequentially consistent, so that a waiter can't miss it (see wait())
+    tail.fetch_add(1);
+    notify();
+  }
+
+  template<typename T>
+  T&
+  SpscRing<T>::front()
+  {
+    return slots[head.load(std::memory_order_relaxed) % slots.size()];
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::pop()
+  {
+    head.fetch_add(1);
+    notify();
+  }
+
+  template<typename T>
+  bool
+  SpscRing<T>::waitNotFull()
+  {
+    wait([this]{ return not full() or closed.load(); });
+    return not closed.load();
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::waitEmpty()
+  {
+    wait([this]{ return empty() or closed.load(); });
+  }
+
+  template<typename T>
+  bool
+  SpscRing<T>::waitNotEmpty()
+  {
+    wait([this]{ return not empty() or closed.load(); });
+    return not empty();
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::close()
+  {
+    closed.store(true);
+    std::lock_guard<std::mutex> lock(waitMutex);
+    waitCondition.notify_all();
+  }
+
+  template<typename T>
+  bool
+  SpscRing<T>::isClosed() const
+  {
+    return closed.load();
+  }
+
+  template<typename T>
+  void
+  SpscRing<T>::notify()
+  {
+    if(waiters.load() == 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(waitMutex);
+    waitCondition.notify_all();
+  }
+
+  template<typename T>
+  template<typename Predicate>
+  void
+  SpscRing<T>::wait(Predicate predicate)
+  {
+    if(predicate())
+      return;
+
+    /*
+     * The waiter is counted before checking again, and the other side
+     * moves its index before reading the count: either the predicate sees
+     * the new index, or notify() sees the waiter and has to take the mutex,
+     * which is released only while waiting.
+     */
+    std::unique_lock<std::mutex> lock(waitMutex);
+    waiters.fetch_add(1);
+    waitCondition.wait(lock, predicate);
+    waiters.fetch_sub(1);
+  }
+}
+
+#endif /* _SPSCRING_H */
@@ -0,0 +1,119 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "StructureAverager.h"
+
+#if GMXVER < 50
+#include <gromacs/do_fit.h>
+#include <gromacs/vec.h>
+#include <gromacs/princ.h>
+#else
+#include <gromacs/math/do_fit.h>
+#include <gromacs/legacyheaders/vec.h>
+#include <gromacs/legacyheaders/princ.h>
+#endif
+
+namespace PstpFinder
+{
+  StructureAverager::StructureAverager(t_topology& top, rvec* xtop,
+                                       int natoms,
+                                       const std::vector<atom_id>& index) :
+      top(top), xtop(xtop), natoms(natoms), index(index),
+      w_rls(top.atoms.nr, 0), state(index.size()), frameX(index.size()),
+      frameY(index.size()), frameZ(index.size())
+  {
+    // Atoms outside the group must not take part to the fit
+    for(atom_id i : index)
+      w_rls[i] = top.atoms.atom[i].m;
+
+    rvec xcm;
+    sub_xcm(xtop, index.size(), this->index.data(), top.atoms.atom, xcm,
+            FALSE);
+    for(int d = 0; d < DIM; d++)
+      state.center[d] = xcm[d];
+  }
+
+  void
+  StructureAverager::addFrame(rvec* x, unsigned int frame)
+  {
+    const unsigned int isize = index.size();
+    rvec frameCenter;
+
+    sub_xcm(x, isize, index.data(), top.atoms.atom, frameCenter, FALSE);
+    do_fit(natoms, w_rls.data(), xtop, x);
+
+    // Gather first, so that the update only touches contiguous arrays
+    for(unsigned int i = 0; i < isize; i++)
+    {
+      frameX[i] = x[index[i]][XX];
+      frameY[i] = x[index[i]][YY];
+      frameZ[i] = x[index[i]][ZZ];
+    }
+
+    const double center[DIM] = { frameCenter[XX], frameCenter[YY],
+                                  frameCenter[ZZ] };
+    state.add(frameX.data(), frameY.data(), frameZ.data(), center, frame);
+  }
+
+  void
+  StructureAverager::merge(const StructureAverager& other)
+  {
+    state.merge(other.state);
+  }
+
+  unsigned int
+  StructureAverager::getFrames() const
+  {
+    return state.count;
+  }
+
+  const AverageState&
+  StructureAverager::getState() const
+  {
+    return state;
+  }
+
+  void
+  StructureAverager::setState(const AverageState& value)
+  {
+    if(value.getAtoms() == index.size())
+      state = value;
+  }
+
+  void
+  StructureAverager::getResults(std::vector<double>& average,
+                                std::vector<double>& rmsf, rvec center) const
+  {
+    const unsigned int isize = index.size();
+    const double invCount = state.count > 0 ? 1.0 / state.count : 0;
+
+    average.resize(isize * DIM);
+    rmsf.resize(isize);
+    for(unsigned int i = 0; i < isize; i++)
+    {
+      average[i * DIM + XX] = state.meanX[i];
+      average[i * DIM + YY] = state.meanY[i];
+      average[i * DIM + ZZ] = state.meanZ[i];
+      rmsf[i] = state.m2[i] * invCount;
+    }
+
+    for(int d = 0; d < DIM; d++)
+      center[d] = state.center[d];
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ *  This file is part of PSTP-finder, an user friendly tool to analyze GROMACS
+ *  molecular dynamics and find transient pockets on the surface of proteins.
+ *  Copyright (C) 2011 Edoardo Morandi.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _STRUCTUREAVERAGER_H
+#define _STRUCTUREAVERAGER_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "AverageState.h"
+
+#include <vector>
+
+#if GMXVER < 50
+extern "C"
+{
+#include <gromacs/typedefs.h>
+}
+#else
+#include <gromacs/legacyheaders/typedefs.h>
+#endif
+
+namespace PstpFinder
+{
+  /**
+   * @brief Average structure and RMSF of a group along a trajectory
+   *
+   * Frames are fitted on the topology structure, from any reader.
+   *
+   * Averagers fed by different threads can be merged.
+   */
+  class StructureAverager
+  {
+    public:
+      StructureAverager(t_topology& top, rvec* xtop, int natoms,
+                        const std::vector<atom_id>& index);
+      StructureAverager(const StructureAverager&) = delete;
+      StructureAverager& operator =(const StructureAverager&) = delete;
+
+      /**
+       * @brief Fits (in place) and accumulates a whole frame
+       * @param frame Position in the trajectory, the last one gives the center
+       */
+      void addFrame(rvec* x, unsigned int frame);
+
+      /**
+       * @brief Adds the frames of another averager of the same group
+       */
+      void merge(const StructureAverager& other);
+      unsigned int getFrames() const;
+      const AverageState& getState() const;
+      void setState(const AverageState& value);
+
+      /**
+       * @brief Average positions relative to center, and RMSF of every atom
+       */
+      void getResults(std::vector<double>& average, std::vector<double>& rmsf,
+                      rvec center) const;
+
+    private:
+      t_topology& top;
+      rvec* xtop;
+      const int natoms;
+      std::vector<atom_id> index;
+      std::vector<real> w_rls;
+      AverageState state;
+      std::vector<double> frameX, frameY, frameZ;
+  };
+}
+
+#endif /* _STRUCTUREAVERAGER_H */